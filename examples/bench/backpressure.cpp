@@ -0,0 +1,122 @@
+/*
+    backpressure: the peer stops reading while the game keeps updating its presence, the way a
+    busy Discord client does, and the connection has to sit it out.
+
+    For each pause the peer stops reading, the caller updates in a tight loop until the socket is
+    full and a write has stalled, then keeps updating every interval_us for the rest of the pause.
+    While paused the bench samples what the library reports as queued, then the peer reads again
+    and the bench waits for the newest update to arrive. Reported per pause:
+    - updates made, and how many were overwritten before they went out
+    - queued bytes at their peak, stalls and stall time from the library's statistics
+    - after resuming, how long until the newest update reached the peer
+    - disconnects and handshakes, which should stay at none and one
+*/
+
+#include "bench.h"
+
+#include <charconv>
+
+#include "discord_rpc.hpp"
+
+int RunBackpressure(int argc, char** argv)
+{
+    int intervalUs = (int)BenchArg(argc, argv, "interval_us", 1000);
+
+    std::atomic<int64_t> lastArrived{-1};
+    std::atomic_uint64_t updatesSeen{0};
+    BenchClock::time_point arrived;
+    SocketPeer peer;
+    bool started = peer.Start([&](int, uint32_t opcode, std::string_view payload, BenchClock::time_point when) {
+        if (opcode != OpFrame || payload.find("\"SET_ACTIVITY\"") == std::string_view::npos)
+            return;
+        ++updatesSeen;
+        int64_t tag = TaggedNumber(payload, "state");
+        if (tag > lastArrived.load())
+        {
+            arrived = when;
+            lastArrived = tag;
+        }
+    });
+    if (!started)
+        return 1;
+
+    std::atomic_bool connected{false};
+    std::atomic_uint64_t disconnects{0};
+    CDiscordEventHandlers handlers;
+    handlers.ready = [&](const CDiscordUser&) { connected = true; };
+    handlers.disconnected = [&](int, const std::string_view&) { ++disconnects; };
+
+    DiscordRpc* rpc = CreateDiscordRpc();
+    rpc->Initialize("100000000000000000", handlers);
+    if (!WaitFor([&] { return connected.load(); }, rpc))
+    {
+        printf("no connection to the bench peer\n");
+        return 1;
+    }
+    WaitFor([&] { return false; }, rpc, 50);
+
+    printf("%s build, an update every %d us once the socket is full\n", BuildName(), intervalUs);
+    printf("%-8s %8s %8s %8s %12s %7s %10s %10s %6s\n", "pause", "updates", "sent", "overwr.", "peak queued", "stalls",
+           "stall ms", "drain us", "disc.");
+
+    CDiscordRichPresence presence = TypicalPresence();
+    char state[24] = "#";
+    int64_t tag = 0;
+    auto update = [&] {
+        char* end = std::to_chars(state + 1, state + sizeof(state), ++tag).ptr;
+        presence.state = std::string_view(state, (size_t)(end - state));
+        rpc->UpdatePresence(presence);
+        PumpConnection(rpc);
+        rpc->RunCallbacks();
+    };
+
+    bool ok = true;
+    for (int pauseMs : {10, 100, 1000, 5000})
+    {
+        auto before = rpc->GetStatistics();
+        int64_t firstTag = tag + 1;
+        uint64_t seenBefore = updatesSeen.load();
+        size_t peakQueued = 0;
+        auto sample = [&] {
+            auto stats = rpc->GetStatistics();
+            peakQueued = std::max(peakQueued, (size_t)stats.sendQueuedBytes);
+            return stats;
+        };
+
+        peer.SetPaused(true);
+        auto start = BenchClock::now();
+        auto end = start + std::chrono::milliseconds(pauseMs);
+        // the kernel takes a few hundred KB before anything has to wait
+        while (sample().sendStalls == before.sendStalls && BenchClock::now() < start + std::chrono::seconds(10))
+            update();
+        while (BenchClock::now() < end)
+        {
+            update();
+            sample();
+            std::this_thread::sleep_for(std::chrono::microseconds(intervalUs));
+        }
+
+        // the peer may read before this thread runs again, so the clock starts first
+        auto resumed = BenchClock::now();
+        peer.SetPaused(false);
+        int64_t newest = tag;
+        bool drained = WaitFor([&] { return lastArrived.load() >= newest; }, rpc, 10000);
+        double drainUs = drained ? ElapsedNs(resumed, arrived) / 1e3 : -1;
+        WaitFor([&] { return rpc->GetStatistics().sendQueuedBytes == 0; }, rpc);
+        auto after = rpc->GetStatistics();
+
+        printf("%-8s %8lld %8llu %8llu %12zu %7llu %10.1f %10.1f %6llu\n", (std::to_string(pauseMs) + " ms").c_str(),
+               (long long)(tag - firstTag + 1), (unsigned long long)(updatesSeen.load() - seenBefore),
+               (unsigned long long)(after.presenceOverwritten - before.presenceOverwritten), peakQueued,
+               (unsigned long long)(after.sendStalls - before.sendStalls),
+               (double)(after.sendStallTime - before.sendStallTime) / 1e3, drainUs, (unsigned long long)disconnects.load());
+        ok = ok && drained && disconnects == 0;
+    }
+
+    printf("handshakes %zu, frames the peer read %llu in %llu reads\n", peer.ReadyClients(), (unsigned long long)peer.FramesRead(),
+           (unsigned long long)peer.ReadCalls());
+    ok = ok && peer.ReadyClients() == 1;
+    rpc->Shutdown();
+    delete rpc;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,469 @@
+/*
+    discord-rpc-bench: measurements behind the performance work in the library.
+
+    Built twice, as discord-rpc-bench with the io thread and as discord-rpc-bench-noio with
+    DISCORD_DISABLE_IO_THREAD, where the bench pumps UpdateConnection itself. Modes that need a
+    Discord client talk to an in-process peer on a unix socket in a private temporary directory.
+
+    usage: discord-rpc-bench <mode> [name=value ...]
+*/
+
+#include "bench.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "discord_rpc.hpp"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static const BenchMode Modes[] = {
+    {"latency", "UpdatePresence to frame at the peer, ACTIVITY_JOIN sent to joinGame fired", RunLatency},
+    {"copies", "bytes copied per presence update on the way to the transport, before and after", RunCopies},
+    {"loopback", "frames per second through the library over the in-memory transport, and a soak", RunLoopback},
+    {"instances", "threads, memory and update latency for 1, 16 and 256 instances", RunInstances},
+    {"serialize", "SET_ACTIVITY serialization against the rapidjson Writer it replaced", RunSerialize},
+    {"escape", "scanning string fields for characters to escape, vector kernel against bytewise", RunEscape},
+    {"parse", "incoming frame to event slot, streaming reader against a DOM", RunParse},
+    {"callbacks", "RunCallbacks with nothing pending, idle and with the io thread busy", RunCallbacks},
+    {"flood", "reads per frame and throughput on a flood of small frames from the peer", RunFlood},
+    {"frames", "frames up to 1 MB, one over the cap, and the inbound memory kept afterwards", RunFrames},
+    {"backpressure", "the peer stops reading while presence updates continue, queued bytes and stall time", RunBackpressure},
+    {"handoff", "presence hand-off to the io thread with the read side hammered, triple buffer against a mutex", RunHandoff},
+};
+
+int64_t BenchArg(int argc, char** argv, const char* name, int64_t fallback)
+{
+    size_t length = strlen(name);
+    for (int i = 0; i < argc; ++i)
+    {
+        if (strncmp(argv[i], name, length) == 0 && argv[i][length] == '=')
+            return strtoll(argv[i] + length + 1, nullptr, 10);
+    }
+    return fallback;
+}
+
+double Samples::Quantile(double q)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1, (size_t)(q * (double)values.size()));
+    return values[index];
+}
+
+void Samples::Report(const char* label)
+{
+    double p50 = Quantile(0.5);
+    double p99 = Quantile(0.99);
+    double p999 = Quantile(0.999);
+    double max = values.empty() ? 0 : values.back();
+    printf("%-44s n=%-7zu p50=%9.1fus p99=%9.1fus p999=%9.1fus max=%9.1fus\n",
+           label, values.size(), p50 / 1000, p99 / 1000, p999 / 1000, max / 1000);
+}
+
+double NsPerIteration(size_t iterations, const std::function<void(size_t)>& body)
+{
+    for (size_t i = 0; i < iterations / 10 + 1; ++i)
+        body(i);
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        body(i);
+    return ElapsedNs(start, BenchClock::now()) / (double)iterations;
+}
+
+static size_t StatusField(const char* name)
+{
+    FILE* file = fopen("/proc/self/status", "r");
+    if (!file)
+        return 0;
+
+    char line[256];
+    size_t value = 0;
+    size_t length = strlen(name);
+    while (fgets(line, sizeof(line), file))
+    {
+        if (strncmp(line, name, length) == 0 && line[length] == ':')
+        {
+            value = (size_t)strtoull(line + length + 1, nullptr, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+size_t ResidentKb()
+{
+    return StatusField("VmRSS");
+}
+
+size_t ThreadCount()
+{
+    return StatusField("Threads");
+}
+
+CDiscordRichPresence TypicalPresence()
+{
+    CDiscordRichPresence presence;
+    presence.state = "In a match - round 1";
+    presence.details = "Ranked 5v5 on Harbor, 3 - 2";
+    presence.startTimestamp = 1700000000;
+    presence.largeImageKey = "map_harbor";
+    presence.largeImageText = "Harbor (night)";
+    presence.smallImageKey = "rank_gold";
+    presence.smallImageText = "Gold III";
+    presence.partyId = "ae488379-351d-4a4f-ad32-2b9b01c91657";
+    presence.partySize = 3;
+    presence.partyMax = 5;
+    return presence;
+}
+
+void PumpConnection(DiscordRpc* rpc)
+{
+#ifdef DISCORD_DISABLE_IO_THREAD
+    rpc->UpdateConnection();
+#else
+    (void)rpc;
+#endif
+}
+
+const char* BuildName()
+{
+#ifdef DISCORD_DISABLE_IO_THREAD
+    return "no io thread";
+#else
+    return "io thread";
+#endif
+}
+
+bool WaitFor(const std::function<bool()>& done, DiscordRpc* rpc, int timeoutMs)
+{
+    auto deadline = BenchClock::now() + std::chrono::milliseconds(timeoutMs);
+    while (!done())
+    {
+        if (BenchClock::now() > deadline)
+            return false;
+        if (rpc)
+        {
+            PumpConnection(rpc);
+            rpc->RunCallbacks();
+        }
+        // on a single core the io thread and the peer need the cpu to make progress
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+int64_t TaggedNumber(std::string_view payload, std::string_view key)
+{
+    std::string pattern = "\"";
+    pattern.append(key).append("\":\"#");
+    size_t at = payload.find(pattern);
+    if (at == std::string_view::npos)
+        return -1;
+
+    int64_t value = 0;
+    bool any = false;
+    for (size_t i = at + pattern.size(); i < payload.size() && payload[i] >= '0' && payload[i] <= '9'; ++i)
+    {
+        value = value * 10 + (payload[i] - '0');
+        any = true;
+    }
+    return any ? value : -1;
+}
+
+static const char ReadyMessage[] =
+    "{\"cmd\":\"DISPATCH\",\"data\":{\"v\":1,\"user\":{\"id\":\"100000000000000000\","
+    "\"username\":\"bench\",\"discriminator\":\"0001\",\"avatar\":null}},\"evt\":\"READY\",\"nonce\":null}";
+
+bool NullTransport::Open()
+{
+    pending.clear();
+    SocketPeer::AppendFrame(pending, OpFrame, ReadyMessage);
+    pendingOffset = 0;
+    open = true;
+    return true;
+}
+
+size_t NullTransport::Write(const ConnectionBuffer* buffers, size_t count)
+{
+    ++writeCalls;
+    size_t length = 0;
+    for (size_t i = 0; i < count; ++i)
+        length += buffers[i].length;
+    buffersWritten += count;
+    bytesWritten += length;
+    return length;
+}
+
+size_t NullTransport::Read(void* data, size_t length)
+{
+    size_t available = std::min(length, pending.size() - pendingOffset);
+    memcpy(data, pending.data() + pendingOffset, available);
+    pendingOffset += available;
+    return available;
+}
+
+void NullTransport::Feed(std::string_view frames)
+{
+    pending.erase(0, pendingOffset);
+    pendingOffset = 0;
+    pending.append(frames);
+}
+
+static bool SendAll(int fd, const char* data, size_t length)
+{
+    while (length)
+    {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                pollfd out{fd, POLLOUT, 0};
+                poll(&out, 1, 100);
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return true;
+}
+
+void SocketPeer::AppendFrame(std::string& frames, uint32_t opcode, std::string_view payload)
+{
+    char header[IPC_HEADER_SIZE];
+    ipcPutHeader(header, opcode, (uint32_t)payload.size());
+    frames.append(header, sizeof(header));
+    frames.append(payload);
+}
+
+SocketPeer::~SocketPeer()
+{
+    Stop();
+}
+
+bool SocketPeer::Start(FrameFunc frameFunc, size_t maxClients, size_t readBytes)
+{
+    char temp[] = "/tmp/discord-rpc-bench-XXXXXX";
+    if (!mkdtemp(temp))
+        return false;
+    directory = temp;
+    path = directory + "/discord-ipc-0";
+    // the library looks here first
+    setenv("XDG_RUNTIME_DIR", directory.c_str(), 1);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+    if (listener == -1 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, (int)maxClients + 16) != 0)
+    {
+        perror("bench peer");
+        Stop();
+        return false;
+    }
+    if (pipe(wakeFds) != 0)
+    {
+        Stop();
+        return false;
+    }
+
+    onFrame = std::move(frameFunc);
+    readSize = readBytes;
+    clients.reserve(maxClients);
+    running = true;
+    thread = std::thread(&SocketPeer::Run, this);
+    return true;
+}
+
+void SocketPeer::Stop()
+{
+    if (running.exchange(false))
+    {
+        char wake = 0;
+        (void)!write(wakeFds[1], &wake, 1);
+        thread.join();
+    }
+    for (auto& client : clients)
+    {
+        if (client->fd != -1)
+            close(client->fd);
+    }
+    clients.clear();
+    for (int& fd : wakeFds)
+    {
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+    }
+    if (listener != -1)
+        close(listener);
+    listener = -1;
+    if (!path.empty())
+        unlink(path.c_str());
+    if (!directory.empty())
+        rmdir(directory.c_str());
+    path.clear();
+    directory.clear();
+}
+
+BenchClock::time_point SocketPeer::Send(int index, uint32_t opcode, std::string_view payload)
+{
+    std::string frame;
+    AppendFrame(frame, opcode, payload);
+
+    Client* client;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        client = clients[(size_t)index].get();
+    }
+    std::lock_guard<std::mutex> lock(client->sendMutex);
+    auto sent = BenchClock::now();
+    SendAll(client->fd, frame.data(), frame.size());
+    return sent;
+}
+
+bool SocketPeer::SendBatch(int index, const std::string& frames)
+{
+    Client* client;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        client = clients[(size_t)index].get();
+    }
+    std::lock_guard<std::mutex> lock(client->sendMutex);
+    return SendAll(client->fd, frames.data(), frames.size());
+}
+
+void SocketPeer::SetPaused(bool pause)
+{
+    paused = pause;
+    char wake = 0;
+    (void)!write(wakeFds[1], &wake, 1);
+}
+
+bool SocketPeer::HandleFrame(int index, uint32_t opcode, std::string_view payload, BenchClock::time_point arrived)
+{
+    ++frames;
+    switch (opcode)
+    {
+        case OpHandshake:
+            Send(index, OpFrame, ReadyMessage);
+            ++ready;
+            return true;
+        case OpPing:
+            Send(index, OpPong, payload);
+            return true;
+        case OpClose:
+            return false;
+        default:
+            if (onFrame)
+                onFrame(index, opcode, payload, arrived);
+            return true;
+    }
+}
+
+void SocketPeer::Run()
+{
+    std::vector<pollfd> fds;
+    std::vector<char> buffer(readSize);
+    while (running)
+    {
+        fds.clear();
+        fds.push_back({wakeFds[0], POLLIN, 0});
+        fds.push_back({listener, POLLIN, 0});
+        if (!paused)
+        {
+            for (auto& client : clients)
+                fds.push_back({client->fd, POLLIN, 0});
+        }
+        if (poll(fds.data(), (nfds_t)fds.size(), 100) <= 0)
+            continue;
+
+        if (fds[0].revents)
+        {
+            char drain[64];
+            (void)!read(wakeFds[0], drain, sizeof(drain));
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd != -1)
+            {
+                auto client = std::make_unique<Client>();
+                client->fd = fd;
+                std::lock_guard<std::mutex> lock(clientsMutex);
+                clients.push_back(std::move(client));
+            }
+        }
+
+        for (size_t i = 2; i < fds.size(); ++i)
+        {
+            if (!fds[i].revents)
+                continue;
+
+            int index = (int)(i - 2);
+            Client& client = *clients[(size_t)index];
+            ssize_t received = recv(client.fd, buffer.data(), buffer.size(), 0);
+            auto arrived = BenchClock::now();
+            if (received <= 0)
+            {
+                // closed clients stay in the list so indices stay stable, poll skips their -1
+                if (received == 0 || (errno != EAGAIN && errno != EINTR))
+                {
+                    std::lock_guard<std::mutex> lock(client.sendMutex);
+                    close(client.fd);
+                    client.fd = -1;
+                }
+                continue;
+            }
+            ++reads;
+            bytes += (uint64_t)received;
+
+            client.pending.append(buffer.data(), (size_t)received);
+            size_t offset = 0;
+            while (size_t size = ipcCompleteFrame(client.pending.data() + offset, client.pending.size() - offset))
+            {
+                const char* frame = client.pending.data() + offset;
+                std::string_view payload(frame + IPC_HEADER_SIZE, size - IPC_HEADER_SIZE);
+                uint32_t opcode = ipcFrameOpcode(frame);
+                offset += size;
+                if (!HandleFrame(index, opcode, payload, arrived))
+                    shutdown(client.fd, SHUT_RDWR);
+            }
+            client.pending.erase(0, offset);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 2)
+    {
+        for (auto& mode : Modes)
+        {
+            if (strcmp(argv[1], mode.name) == 0)
+                return mode.run(argc - 2, argv + 2);
+        }
+    }
+
+    printf("usage: %s <mode> [name=value ...]\n\nmodes (%s build):\n", argv[0], BuildName());
+    for (auto& mode : Modes)
+        printf("  %-12s %s\n", mode.name, mode.description);
+    return 1;
+}
@@ -0,0 +1,182 @@
+#pragma once
+/*
+    Shared pieces of discord-rpc-bench: timing, percentiles, process stats and a socket peer
+    standing in for the Discord client. Each mode lives in its own file and is listed in bench.cpp.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "ipc_frame.h"
+#include "transport.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+// one mode of the benchmark, run with the arguments after its name
+struct BenchMode
+{
+    const char* name;
+    const char* description;
+    int (*run)(int argc, char** argv);
+};
+
+// "name=value" argument as a number, fallback if it isn't there
+int64_t BenchArg(int argc, char** argv, const char* name, int64_t fallback);
+
+inline double ElapsedNs(BenchClock::time_point from, BenchClock::time_point to)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+}
+
+// latency samples in nanoseconds, reported as percentiles in microseconds
+class Samples
+{
+    std::vector<double> values;
+
+public:
+    void Reserve(size_t count) { values.reserve(count); }
+    void Add(double ns) { values.push_back(ns); }
+    void Add(BenchClock::time_point from, BenchClock::time_point to) { Add(ElapsedNs(from, to)); }
+    size_t Count() const { return values.size(); }
+
+    // quantile in nanoseconds, q in [0, 1]; sorts the samples
+    double Quantile(double q);
+    // one line: label, count, p50, p99, p999 and max in microseconds
+    void Report(const char* label);
+};
+
+// runs body iterations times after a warm-up and returns nanoseconds per iteration
+double NsPerIteration(size_t iterations, const std::function<void(size_t)>& body);
+
+// from /proc/self/status, 0 where it isn't available
+size_t ResidentKb();
+size_t ThreadCount();
+
+// a presence the size of what games send: state, details, both images, timestamps and a party
+struct CDiscordRichPresence;
+CDiscordRichPresence TypicalPresence();
+
+// pumps an instance from the caller when the io thread is compiled out
+class DiscordRpc;
+void PumpConnection(DiscordRpc* rpc);
+const char* BuildName();
+
+// listens on discord-ipc-0 in a private temporary directory that the library is pointed at,
+// answers handshakes with READY and pings with pongs, and hands every other frame to a callback
+class SocketPeer
+{
+public:
+    // client index, opcode, payload and when the read carrying it returned
+    using FrameFunc = std::function<void(int client, uint32_t opcode, std::string_view payload, BenchClock::time_point arrived)>;
+
+    SocketPeer() = default;
+    SocketPeer(const SocketPeer&) = delete;
+    SocketPeer& operator=(const SocketPeer&) = delete;
+    ~SocketPeer();
+
+    bool Start(FrameFunc onFrame, size_t maxClients = 1, size_t readSize = 64 * 1024);
+    void Stop();
+
+    // sends one frame to a client, returns the time just before the send; blocking
+    BenchClock::time_point Send(int client, uint32_t opcode, std::string_view payload);
+    // several frames in one send, for floods
+    bool SendBatch(int client, const std::string& frames);
+    static void AppendFrame(std::string& frames, uint32_t opcode, std::string_view payload);
+
+    // stops reading so the library's writes back up, reading resumes on false
+    void SetPaused(bool paused);
+
+    size_t ReadyClients() const { return ready.load(); }
+    uint64_t ReadCalls() const { return reads.load(); }
+    uint64_t FramesRead() const { return frames.load(); }
+    uint64_t BytesRead() const { return bytes.load(); }
+
+private:
+    struct Client
+    {
+        int fd{-1};
+        std::string pending;
+        std::mutex sendMutex;
+    };
+
+    void Run();
+    bool HandleFrame(int index, uint32_t opcode, std::string_view payload, BenchClock::time_point arrived);
+
+    FrameFunc onFrame;
+    std::string directory;
+    std::string path;
+    int listener{-1};
+    int wakeFds[2]{-1, -1};
+    size_t readSize{0};
+    std::vector<std::unique_ptr<Client>> clients;
+    std::mutex clientsMutex;
+    std::thread thread;
+    std::atomic_bool running{false};
+    std::atomic_bool paused{false};
+    std::atomic_size_t ready{0};
+    std::atomic_uint64_t reads{0};
+    std::atomic_uint64_t frames{0};
+    std::atomic_uint64_t bytes{0};
+};
+
+// takes every write without a kernel underneath and answers the handshake with READY;
+// counts what it was handed so modes can tell how frames reach the transport
+class NullTransport : public Transport
+{
+    std::atomic_bool open{false};
+    std::string pending;
+    size_t pendingOffset{0};
+
+public:
+    uint64_t writeCalls{0};
+    uint64_t buffersWritten{0};
+    uint64_t bytesWritten{0};
+
+    bool Open() override;
+    void Close() override { open = false; }
+    bool IsOpen() const override { return open; }
+    int GetHandle() const override { return -1; }
+
+    using Transport::Write;
+    size_t Write(const ConnectionBuffer* buffers, size_t count) override;
+    size_t Read(void* data, size_t length) override;
+
+    // queues frames for Read to hand out after what is still pending
+    void Feed(std::string_view frames);
+    size_t Unread() const { return pending.size() - pendingOffset; }
+};
+
+// framing is the mock server's, see ipc_frame.h
+constexpr uint32_t OpHandshake = IPC_OP_HANDSHAKE;
+constexpr uint32_t OpFrame = IPC_OP_FRAME;
+constexpr uint32_t OpClose = IPC_OP_CLOSE;
+constexpr uint32_t OpPing = IPC_OP_PING;
+constexpr uint32_t OpPong = IPC_OP_PONG;
+
+// the number after "#" in the state or secret the bench put in a frame, -1 if there is none
+int64_t TaggedNumber(std::string_view payload, std::string_view key);
+
+// spins until done returns true or the timeout passes, pumping the instance if given
+bool WaitFor(const std::function<bool()>& done, DiscordRpc* rpc = nullptr, int timeoutMs = 5000);
+
+int RunLatency(int argc, char** argv);
+int RunCopies(int argc, char** argv);
+int RunLoopback(int argc, char** argv);
+int RunInstances(int argc, char** argv);
+int RunSerialize(int argc, char** argv);
+int RunEscape(int argc, char** argv);
+int RunParse(int argc, char** argv);
+int RunCallbacks(int argc, char** argv);
+int RunFlood(int argc, char** argv);
+int RunFrames(int argc, char** argv);
+int RunBackpressure(int argc, char** argv);
+int RunHandoff(int argc, char** argv);
@@ -0,0 +1,134 @@
+/*
+    callbacks: what a game pays per frame for RunCallbacks when nothing is pending.
+
+    An instance is connected to the socket peer with every handler set. Calls are timed in
+    groups of 64 to keep the clock out of the figures, so percentiles are of the average over
+    a group:
+    - idle: nothing arrives
+    - busy: the peer floods SET_ACTIVITY replies, which the io thread reads and parses while the
+      caller runs RunCallbacks; none of them dispatches anything
+    - before: the empty path of RunCallbacks as it was before the seqlock slots, rebuilt here:
+      a handlers mutex, then an exchange on each event flag
+
+    Without the io thread the bench pumps UpdateConnection between groups, outside the timing.
+*/
+
+#include "bench.h"
+
+#include <mutex>
+
+#include "discord_rpc.hpp"
+
+namespace
+{
+
+constexpr size_t GroupCalls = 64;
+
+// the old RunCallbacks with nothing pending: locked handlers, an exchange per event flag
+class LegacyCallbacks
+{
+    std::mutex mutex;
+    std::atomic_bool awaiting[5]{};
+    std::atomic_uint64_t nextAdd{0};
+    std::atomic_uint64_t nextSend{0};
+
+public:
+    int Run()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        int fired = 0;
+        for (auto& flag : awaiting)
+            fired += flag.exchange(false);
+        while (nextSend.load(std::memory_order_acquire) != nextAdd.load(std::memory_order_acquire))
+            ++nextSend;
+        return fired;
+    }
+};
+
+Samples TimeGroups(size_t groups, const std::function<void()>& call, const std::function<void()>& between)
+{
+    Samples samples;
+    samples.Reserve(groups);
+    for (size_t g = 0; g < groups; ++g)
+    {
+        auto start = BenchClock::now();
+        for (size_t i = 0; i < GroupCalls; ++i)
+            call();
+        samples.Add(ElapsedNs(start, BenchClock::now()) / GroupCalls);
+        between();
+    }
+    return samples;
+}
+
+void Report(const char* label, Samples& samples)
+{
+    printf("%-32s p50=%7.1f ns p99=%7.1f ns p999=%8.1f ns max=%9.1f ns\n", label, samples.Quantile(0.5), samples.Quantile(0.99),
+           samples.Quantile(0.999), samples.Quantile(1.0));
+}
+
+} // namespace
+
+int RunCallbacks(int argc, char** argv)
+{
+    size_t groups = (size_t)BenchArg(argc, argv, "count", 200000);
+
+    std::atomic_uint64_t replies{0};
+    SocketPeer peer;
+    if (!peer.Start(nullptr))
+        return 1;
+
+    std::atomic_bool connected{false};
+    std::atomic_uint64_t fired{0};
+    CDiscordEventHandlers handlers;
+    handlers.ready = [&](const CDiscordUser&) { connected = true; };
+    handlers.disconnected = [&](int, const std::string_view&) { ++fired; };
+    handlers.errored = [&](int, const std::string_view&) { ++fired; };
+    handlers.joinGame = [&](const std::string_view&) { ++fired; };
+    handlers.spectateGame = [&](const std::string_view&) { ++fired; };
+    handlers.joinRequest = [&](const CDiscordUser&) { ++fired; };
+
+    DiscordRpc* rpc = CreateDiscordRpc();
+    rpc->Initialize("100000000000000000", handlers);
+    if (!WaitFor([&] { return connected.load(); }, rpc))
+    {
+        printf("no connection to the bench peer\n");
+        return 1;
+    }
+    // let the subscriptions go out
+    WaitFor([&] { return false; }, rpc, 50);
+
+    printf("%s build, %zu groups of %zu calls, ns per call\n", BuildName(), groups, GroupCalls);
+    auto pump = [&] { PumpConnection(rpc); };
+    Samples idle = TimeGroups(groups, [&] { rpc->RunCallbacks(); }, pump);
+    Report("idle", idle);
+
+    // what the client answers to SET_ACTIVITY, 32 to a send
+    std::string batch;
+    for (int i = 0; i < 32; ++i)
+    {
+        SocketPeer::AppendFrame(batch, OpFrame,
+                                "{\"cmd\":\"SET_ACTIVITY\",\"data\":{\"state\":\"In a match - round 1\",\"details\":\"Ranked 5v5 on Harbor\","
+                                "\"assets\":{\"large_image\":\"map_harbor\"},\"name\":\"Bench\",\"application_id\":\"100000000000000000\","
+                                "\"type\":0,\"flags\":0,\"instance\":false},\"evt\":null,\"nonce\":\"12\"}");
+    }
+    std::atomic_bool flooding{true};
+    std::thread flood([&] {
+        while (flooding && peer.SendBatch(0, batch))
+            replies += 32;
+    });
+    Samples busy = TimeGroups(groups, [&] { rpc->RunCallbacks(); }, pump);
+    flooding = false;
+    flood.join();
+    Report("busy, io thread parsing replies", busy);
+
+    LegacyCallbacks legacy;
+    Samples before = TimeGroups(groups, [&] { legacy.Run(); }, [] {});
+    Report("before, mutex and exchanges", before);
+
+    auto stats = rpc->GetStatistics();
+    printf("replies sent %llu, frames received %llu, callbacks fired %llu\n", (unsigned long long)replies.load(),
+           (unsigned long long)stats.framesReceived, (unsigned long long)fired.load());
+    rpc->Shutdown();
+    delete rpc;
+    return fired ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+/*
+    copies: what a presence update costs between the serializer and the transport.
+
+    The library's path runs CmdChannel and RpcConnection over a NullTransport on one thread.
+    The earlier hand-offs are rebuilt here from the code they replaced, with counters, on top of
+    today's serializer:
+    - baseline: a 16 KB Buffer copied into PresenceEvent under its mutex and copied out again
+      (its zero-initialised array cleared on every copy construction), then the payload
+      copied behind the header into the 64 KB MessageFrame and written in one piece
+    - gathered: the same hand-off, but header and payload go out as two buffers of one write
+*/
+
+#include "bench.h"
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include "cmd_channel.h"
+#include "discord_rpc.hpp"
+#include "rpc_connection.h"
+#include "serialization.h"
+
+namespace
+{
+
+struct CopyCounters
+{
+    uint64_t copied{0};
+    uint64_t cleared{0};
+};
+
+CopyCounters Counters;
+
+struct LegacyBuffer
+{
+    size_t length{};
+    char buffer[16 * 1024]{};
+
+    LegacyBuffer()
+    {
+    }
+
+    LegacyBuffer(const LegacyBuffer& other)
+    {
+        Counters.cleared += sizeof(buffer);
+        length = other.length;
+        memcpy(buffer, other.buffer, length);
+        Counters.copied += length;
+    }
+
+    LegacyBuffer& operator=(const LegacyBuffer& other)
+    {
+        length = other.length;
+        memcpy(buffer, other.buffer, length);
+        Counters.copied += length;
+        return *this;
+    }
+};
+
+class LegacyPresenceEvent
+{
+    std::atomic_bool awaiting{false};
+    std::mutex mutex;
+    LegacyBuffer data;
+
+public:
+    void Set(const LegacyBuffer& value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        data = value;
+        awaiting = true;
+    }
+
+    bool Consume() { return awaiting.exchange(false); }
+
+    LegacyBuffer GetBuffer()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return data;
+    }
+};
+
+struct LegacyFrame
+{
+    uint32_t opcode;
+    uint32_t length;
+    char message[64 * 1024 - 8];
+};
+
+struct LegacyChannel
+{
+    LegacyPresenceEvent presenceUpdate;
+    LegacyBuffer presenceBuff;
+    LegacyFrame frame;
+    int nonce{1};
+};
+
+void LegacyUpdate(LegacyChannel& channel, NullTransport& transport, const CDiscordRichPresence& presence, bool gathered)
+{
+    channel.presenceBuff.length = JsonWriteRichPresenceObj(channel.presenceBuff.buffer, sizeof(channel.presenceBuff.buffer),
+                                                           channel.nonce++, 1234, &presence);
+    channel.presenceUpdate.Set(channel.presenceBuff);
+
+    if (!channel.presenceUpdate.Consume())
+        return;
+    auto local = channel.presenceUpdate.GetBuffer();
+    channel.frame.opcode = OpFrame;
+    channel.frame.length = (uint32_t)local.length;
+    if (gathered)
+    {
+        ConnectionBuffer buffers[]{{&channel.frame, 8}, {local.buffer, local.length}};
+        transport.Write(buffers, 2);
+    }
+    else
+    {
+        memcpy(channel.frame.message, local.buffer, local.length);
+        Counters.copied += local.length;
+        transport.Write(&channel.frame, 8 + local.length);
+    }
+}
+
+} // namespace
+
+int RunCopies(int argc, char** argv)
+{
+    size_t count = (size_t)BenchArg(argc, argv, "count", 200000);
+
+    // updates alternate between states so none of them is skipped as a duplicate
+    std::string states[16];
+    for (size_t i = 0; i < 16; ++i)
+        states[i] = "In a match - round " + std::to_string(i + 1);
+    CDiscordRichPresence presence = TypicalPresence();
+
+    printf("%zu updates each, typical presence\n", count);
+    printf("%-32s %12s %14s %14s %12s %12s\n", "path", "ns/update", "copied/update", "cleared/update", "bytes/write", "bufs/write");
+
+    for (bool gathered : {false, true})
+    {
+        auto channel = std::make_unique<LegacyChannel>();
+        NullTransport transport;
+        Counters = {};
+        double ns = NsPerIteration(count, [&](size_t i) {
+            presence.state = states[i % 16];
+            LegacyUpdate(*channel, transport, presence, gathered);
+        });
+        double updates = (double)(count + count / 10 + 1);
+        printf("%-32s %12.1f %14.0f %14.0f %12.0f %12.1f\n", gathered ? "gathered, mutex hand-off" : "baseline, frame copy", ns,
+               (double)Counters.copied / updates, (double)Counters.cleared / updates,
+               (double)transport.bytesWritten / (double)transport.writeCalls, (double)transport.buffersWritten / (double)transport.writeCalls);
+    }
+
+    for (bool direct : {false, true})
+    {
+        auto connection = std::make_unique<RpcConnection>();
+        NullTransport transport;
+        connection->SetApplicationId("100000000000000000");
+        connection->SetTransport(&transport);
+        for (int i = 0; i < 2 && !connection->IsOpen(); ++i)
+            connection->Open();
+        if (!connection->IsOpen())
+        {
+            printf("NullTransport handshake failed\n");
+            return 1;
+        }
+
+        auto channel = std::make_unique<CmdChannel>(*connection);
+        channel->SetDirectSend(direct);
+        uint64_t writesBefore = transport.writeCalls;
+        uint64_t buffersBefore = transport.buffersWritten;
+        uint64_t bytesBefore = transport.bytesWritten;
+        double ns = NsPerIteration(count, [&](size_t i) {
+            presence.state = states[i % 16];
+            channel->UpdatePresence(&presence);
+            channel->SendData();
+        });
+        uint64_t writes = transport.writeCalls - writesBefore;
+        // the triple buffer's Set copies the serialized frame once, a direct send writes it from where it was serialized
+        double bytes = (double)(transport.bytesWritten - bytesBefore) / (double)writes;
+        printf("%-32s %12.1f %14.0f %14.0f %12.0f %12.1f\n", direct ? "library, direct send" : "library, triple buffer", ns,
+               direct ? 0.0 : bytes - 8, 0.0, bytes, (double)(transport.buffersWritten - buffersBefore) / (double)writes);
+    }
+    printf("library rows: the copy is the one Buffer copy into the triple buffer slot, read off the code rather than counted\n");
+    return 0;
+}
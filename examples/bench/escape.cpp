@@ -0,0 +1,104 @@
+/*
+    escape: the scan for characters JSON needs escaped, at the field lengths presence strings have.
+
+    Compares FindJsonEscape, the vector kernel the library picks at runtime, with a byte at a time
+    loop like the one it replaced. Strings are clean, so each call scans the whole field. They
+    start at varying offsets in a buffer larger than L1, so alignment and cache misses average out.
+    - lengths from 4 bytes to the 128-byte limit of the text fields
+    - typical: the string fields of the typical presence, 8 to 36 bytes, in turn
+*/
+
+#include "bench.h"
+
+#include <cstring>
+
+#include "discord_rpc.hpp"
+#include "json_escape.h"
+
+namespace
+{
+
+const char* FindJsonEscapeBytewise(const char* text, const char* end)
+{
+    while (text < end && (unsigned char)*text >= 0x20 && *text != '"' && *text != '\\')
+        ++text;
+    return text;
+}
+
+struct Field
+{
+    const char* text;
+    size_t length;
+};
+
+// count fields of the given lengths, cycling through them, spread over a 1 MB buffer
+std::vector<Field> SpreadFields(std::vector<char>& buffer, const std::vector<size_t>& lengths, size_t count)
+{
+    std::vector<Field> fields;
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t length = lengths[i % lengths.size()];
+        // a prime stride walks through every alignment
+        offset = (offset + 4099) % (buffer.size() - 256);
+        fields.push_back({buffer.data() + offset, length});
+    }
+    return fields;
+}
+
+double NsPerField(const std::vector<Field>& fields, size_t count, const char* (*find)(const char*, const char*))
+{
+    size_t found = 0;
+    double ns = NsPerIteration(count, [&](size_t i) {
+        auto& field = fields[i % fields.size()];
+        found += (size_t)(find(field.text, field.text + field.length) - field.text);
+    });
+    // keeps the scans from being optimised away
+    if (found == 0)
+        printf("nothing scanned\n");
+    return ns;
+}
+
+} // namespace
+
+int RunEscape(int argc, char** argv)
+{
+    size_t count = (size_t)BenchArg(argc, argv, "count", 10000000);
+
+    // printable ASCII with nothing to escape
+    std::vector<char> buffer(1 << 20);
+    for (size_t i = 0; i < buffer.size(); ++i)
+    {
+        char c = (char)(' ' + i % 95);
+        buffer[i] = c == '"' || c == '\\' ? 'x' : c;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    const char* kernel = __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#else
+    const char* kernel = "scalar";
+#endif
+    printf("%zu scans each, library kernel %s\n", count, kernel);
+    printf("%-8s %14s %14s %12s %8s\n", "length", "bytewise ns", "library ns", "library GB/s", "speedup");
+
+    auto report = [&](const char* label, const std::vector<size_t>& lengths) {
+        auto fields = SpreadFields(buffer, lengths, 4096);
+        double bytes = 0;
+        for (auto& field : fields)
+            bytes += (double)field.length;
+        bytes /= (double)fields.size();
+
+        double bytewise = NsPerField(fields, count, FindJsonEscapeBytewise);
+        double library = NsPerField(fields, count, FindJsonEscape);
+        printf("%-8s %14.1f %14.1f %12.2f %7.1fx\n", label, bytewise, library, bytes / library, bytewise / library);
+    };
+
+    for (size_t length : {4, 8, 16, 24, 31, 32, 48, 64, 96, 128})
+        report(std::to_string(length).c_str(), {length});
+
+    CDiscordRichPresence presence = TypicalPresence();
+    report("typical", {presence.state.size(), presence.details.size(), presence.largeImageKey.size(), presence.largeImageText.size(),
+                       presence.smallImageKey.size(), presence.smallImageText.size(), presence.partyId.size()});
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+    flood: a local peer sending small frames as fast as it can, how many reads each frame
+    costs and how many frames per second get through.
+
+    - library: the peer floods ACTIVITY_JOIN frames at an instance, which reads, parses and
+      dispatches them while the caller runs RunCallbacks; reads are the library's own count
+    - two reads per frame: a bench-side reader over a socket pair that receives the header and
+      then the body, the way RpcConnection::Read did before it read ahead
+    - read-ahead: the same reader receiving up to 64 KB at a time and splitting frames out of it
+    The bench-side readers only split frames, they don't parse them.
+*/
+
+#include "bench.h"
+
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "discord_rpc.hpp"
+
+namespace
+{
+
+// sends batch until frames have gone out, on its own thread
+class Flood
+{
+    std::thread thread;
+
+public:
+    Flood(const std::function<bool(const std::string&)>& send, const std::string& batch, uint64_t batches)
+    {
+        thread = std::thread([=] {
+            for (uint64_t i = 0; i < batches && send(batch); ++i)
+                ;
+        });
+    }
+
+    ~Flood() { thread.join(); }
+};
+
+struct RawResult
+{
+    uint64_t frames{0};
+    uint64_t reads{0};
+    double ns{0};
+};
+
+RawResult ReadRaw(const std::string& batch, uint64_t batches, uint64_t frames, bool readAhead)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return {};
+
+    RawResult result;
+    auto start = BenchClock::now();
+    {
+        Flood flood([&](const std::string& data) { return send(fds[1], data.data(), data.size(), MSG_NOSIGNAL) == (ssize_t)data.size(); },
+                    batch, batches);
+
+        std::vector<char> buffer(64 * 1024);
+        size_t used = 0;
+        // reads exactly length bytes into buffer at used
+        auto readExact = [&](size_t length) {
+            while (length)
+            {
+                ssize_t received = recv(fds[0], buffer.data() + used, length, 0);
+                ++result.reads;
+                if (received <= 0)
+                    return false;
+                used += (size_t)received;
+                length -= (size_t)received;
+            }
+            return true;
+        };
+
+        while (result.frames < frames)
+        {
+            if (!readAhead)
+            {
+                used = 0;
+                if (!readExact(IPC_HEADER_SIZE) || !readExact(ipcFrameLength(buffer.data())))
+                    break;
+                ++result.frames;
+                continue;
+            }
+
+            ssize_t received = recv(fds[0], buffer.data() + used, buffer.size() - used, 0);
+            ++result.reads;
+            if (received <= 0)
+                break;
+            used += (size_t)received;
+            size_t offset = 0;
+            while (size_t size = ipcCompleteFrame(buffer.data() + offset, used - offset))
+            {
+                offset += size;
+                ++result.frames;
+            }
+            memmove(buffer.data(), buffer.data() + offset, used - offset);
+            used -= offset;
+        }
+    }
+    result.ns = ElapsedNs(start, BenchClock::now());
+    close(fds[0]);
+    close(fds[1]);
+    return result;
+}
+
+void Report(const char* label, uint64_t frames, uint64_t reads, double ns, size_t frameBytes)
+{
+    printf("%-22s %10.0f frames/s %8.1f MB/s %8.4f reads/frame, %6.1f frames/read\n", label, (double)frames * 1e9 / ns,
+           (double)(frames * frameBytes) * 1e3 / ns, (double)reads / (double)frames, (double)frames / (double)reads);
+}
+
+} // namespace
+
+int RunFlood(int argc, char** argv)
+{
+    uint64_t frames = (uint64_t)BenchArg(argc, argv, "count", 2000000);
+
+    std::string payload = "{\"cmd\":\"DISPATCH\",\"data\":{\"secret\":\"#0\"},\"evt\":\"ACTIVITY_JOIN\",\"nonce\":null}";
+    std::string batch;
+    for (int i = 0; i < 256; ++i)
+        SocketPeer::AppendFrame(batch, OpFrame, payload);
+    uint64_t batches = (frames + 255) / 256;
+    frames = batches * 256;
+    size_t frameBytes = 8 + payload.size();
+
+    SocketPeer peer;
+    if (!peer.Start(nullptr))
+        return 1;
+
+    std::atomic_bool connected{false};
+    std::atomic_uint64_t joins{0};
+    CDiscordEventHandlers handlers;
+    handlers.ready = [&](const CDiscordUser&) { connected = true; };
+    handlers.joinGame = [&](const std::string_view&) { ++joins; };
+
+    DiscordRpc* rpc = CreateDiscordRpc();
+    rpc->Initialize("100000000000000000", handlers);
+    if (!WaitFor([&] { return connected.load(); }, rpc))
+    {
+        printf("no connection to the bench peer\n");
+        return 1;
+    }
+    WaitFor([&] { return false; }, rpc, 50);
+
+    printf("%s build, %llu frames of %zu bytes, sent 256 to a write\n", BuildName(), (unsigned long long)frames, frameBytes);
+
+    auto before = rpc->GetStatistics();
+    auto start = BenchClock::now();
+    bool complete;
+    {
+        Flood flood([&](const std::string& data) { return peer.SendBatch(0, data); }, batch, batches);
+        complete = WaitFor([&] { return rpc->GetStatistics().framesReceived - before.framesReceived >= frames; }, rpc, 120000);
+    }
+    double ns = ElapsedNs(start, BenchClock::now());
+    rpc->RunCallbacks();
+    auto after = rpc->GetStatistics();
+    if (!complete)
+        printf("only %llu frames arrived\n", (unsigned long long)(after.framesReceived - before.framesReceived));
+    Report("library", after.framesReceived - before.framesReceived, after.receiveCalls - before.receiveCalls, ns, frameBytes);
+    printf("%-22s io wakeups %llu, joinGame fired %llu times\n", "", (unsigned long long)(after.ioWakeups - before.ioWakeups),
+           (unsigned long long)joins.load());
+    rpc->Shutdown();
+    delete rpc;
+
+    RawResult twoReads = ReadRaw(batch, batches, frames, false);
+    Report("two reads per frame", twoReads.frames, twoReads.reads, twoReads.ns, frameBytes);
+    RawResult readAhead = ReadRaw(batch, batches, frames, true);
+    Report("read-ahead", readAhead.frames, readAhead.reads, readAhead.ns, frameBytes);
+    return complete ? 0 : 1;
+}
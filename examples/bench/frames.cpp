@@ -0,0 +1,200 @@
+/*
+    frames: frames far larger than presence traffic, the cap on them, and the inbound memory an
+    instance keeps once they are over.
+
+    The frame size cap is raised to 2 MB and the peer sends ACTIVITY_JOIN frames padded to 16 KB,
+    64 KB, 256 KB and 1 MB, then one of 4 MB that is over the cap and a small one behind it:
+    - library: an instance connected to the socket peer; throughput per size, the connection
+      staying up through the dropped frame, and heap in use and resident memory after each step
+    - buffer: an RpcConnection over a NullTransport reading the same frames on the bench thread,
+      which can look at the inbound buffer's capacity directly
+    After the large frames come InboundShrinkFrames small ones, which should give the grown buffer
+    back, then a close from the peer, after which the connection holds no inbound memory.
+*/
+
+#include "bench.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "discord_rpc.hpp"
+#include "rpc_connection.h"
+
+namespace
+{
+
+constexpr size_t FrameCap = 2 * 1024 * 1024;
+constexpr size_t OverCap = 4 * 1024 * 1024;
+constexpr size_t SmallFrames = InboundShrinkFrames + 8;
+
+// an ACTIVITY_JOIN of size bytes, header included, tagged so it can be told apart
+std::string LargeJoin(size_t size, int64_t tag)
+{
+    std::string head = "{\"cmd\":\"DISPATCH\",\"data\":{\"secret\":\"#" + std::to_string(tag) + "\",\"padding\":\"";
+    std::string tail = "\"},\"evt\":\"ACTIVITY_JOIN\",\"nonce\":null}";
+    size_t padding = size - 8 - head.size() - tail.size();
+    std::string frame;
+    SocketPeer::AppendFrame(frame, OpFrame, head + std::string(padding, 'x') + tail);
+    return frame;
+}
+
+std::string SizeName(size_t size)
+{
+    return size >= 1024 * 1024 ? std::to_string(size / (1024 * 1024)) + " MB" : std::to_string(size / 1024) + " KB";
+}
+
+// allocated and not yet freed across all arenas, 0 where the allocator can't tell;
+// unlike the resident size it drops as soon as the library frees a buffer
+size_t HeapInUseKb()
+{
+#ifdef __GLIBC__
+    struct mallinfo2 info = mallinfo2();
+    return (info.uordblks + info.hblkhd) / 1024;
+#else
+    return 0;
+#endif
+}
+
+void ReportMemory(const char* label, size_t baseKb)
+{
+    size_t rss = ResidentKb();
+    printf("%-30s heap in use %6zu KB, rss %6zu KB (%+lld KB)\n", label, HeapInUseKb(), rss, (long long)rss - (long long)baseKb);
+}
+
+int RunLibrary(const std::vector<size_t>& sizes, size_t count)
+{
+    SocketPeer peer;
+    if (!peer.Start(nullptr))
+        return 1;
+
+    std::atomic_bool connected{false};
+    std::atomic_uint64_t joins{0};
+    std::atomic_uint64_t disconnects{0};
+    CDiscordEventHandlers handlers;
+    handlers.ready = [&](const CDiscordUser&) { connected = true; };
+    handlers.disconnected = [&](int, const std::string_view&) { ++disconnects; };
+    handlers.joinGame = [&](const std::string_view&) { ++joins; };
+
+    DiscordRpc* rpc = CreateDiscordRpc();
+    rpc->SetMaxFrameSize(FrameCap);
+    rpc->Initialize("100000000000000000", handlers);
+    if (!WaitFor([&] { return connected.load(); }, rpc))
+    {
+        printf("no connection to the bench peer\n");
+        return 1;
+    }
+    WaitFor([&] { return false; }, rpc, 50);
+    size_t baseKb = ResidentKb();
+    printf("library, %s build, cap %s, %zu frames of each size\n", BuildName(), SizeName(FrameCap).c_str(), count);
+    ReportMemory("connected", baseKb);
+
+    // the peer's sends block until the instance reads, so they go out from another thread;
+    // joinGame only fires for the latest secret per RunCallbacks, so arrival is counted in frames
+    auto deliver = [&](const std::string& frame, size_t times, uint64_t frames) {
+        uint64_t expected = rpc->GetStatistics().framesReceived + frames;
+        std::thread sender([&] {
+            for (size_t i = 0; i < times && peer.SendBatch(0, frame); ++i)
+                ;
+        });
+        bool complete = WaitFor([&] { return rpc->GetStatistics().framesReceived >= expected; }, rpc, 60000);
+        sender.join();
+        rpc->RunCallbacks();
+        return complete;
+    };
+
+    bool ok = true;
+    for (size_t size : sizes)
+    {
+        uint64_t joinsBefore = joins.load();
+        auto start = BenchClock::now();
+        ok = deliver(LargeJoin(size, 0), count, count) && ok;
+        double ns = ElapsedNs(start, BenchClock::now());
+        printf("%-8s %8.0f frames/s %8.1f MB/s, joinGame fired %llu times\n", SizeName(size).c_str(), (double)count * 1e9 / ns,
+               (double)(count * size) * 1e3 / ns, (unsigned long long)(joins.load() - joinsBefore));
+        ok = ok && joins.load() > joinsBefore;
+        ReportMemory(("after " + SizeName(size)).c_str(), baseKb);
+    }
+
+    // over the cap: skipped, and the small frame behind it still arrives on the same connection
+    auto before = rpc->GetStatistics();
+    uint64_t joinsBefore = joins.load();
+    ok = deliver(LargeJoin(OverCap, 0) + LargeJoin(256, 1), 1, 1) && ok;
+    auto after = rpc->GetStatistics();
+    bool fired = joins.load() > joinsBefore;
+    printf("%-8s dropped %llu, joinGame fired behind it %s, disconnects %llu, handshakes %zu\n", SizeName(OverCap).c_str(),
+           (unsigned long long)(after.framesDropped - before.framesDropped), fired ? "yes" : "no",
+           (unsigned long long)disconnects.load(), peer.ReadyClients());
+    ok = ok && fired && after.framesDropped - before.framesDropped == 1 && disconnects == 0 && peer.ReadyClients() == 1;
+    ReportMemory(("after " + SizeName(OverCap)).c_str(), baseKb);
+
+    // one at a time so each arrives in its own read, the way presence traffic does
+    std::string small = LargeJoin(256, 1);
+    for (size_t i = 0; i < SmallFrames; ++i)
+        ok = deliver(small, 1, 1) && ok;
+    ReportMemory(("after " + std::to_string(SmallFrames) + " small").c_str(), baseKb);
+
+    peer.Send(0, OpClose, "{\"code\":1000,\"message\":\"bench\"}");
+    ok = WaitFor([&] { return disconnects.load() == 1; }, rpc) && ok;
+    ReportMemory("after close", baseKb);
+
+    rpc->Shutdown();
+    delete rpc;
+    return ok ? 0 : 1;
+}
+
+int RunBuffer(const std::vector<size_t>& sizes)
+{
+    NullTransport transport;
+    RpcConnection connection;
+    connection.SetApplicationId("100000000000000000");
+    connection.SetTransport(&transport);
+    connection.SetMaxFrameSize(FrameCap);
+    for (int i = 0; i < 2 && !connection.IsOpen(); ++i)
+        connection.Open();
+    if (!connection.IsOpen())
+    {
+        printf("NullTransport handshake failed\n");
+        return 1;
+    }
+
+    auto readAll = [&](const std::string& frames) {
+        transport.Feed(frames);
+        char* message;
+        size_t length;
+        uint64_t read = 0;
+        while (connection.Read(message, length))
+            ++read;
+        return read;
+    };
+    auto report = [&](const std::string& label, uint64_t read) {
+        printf("%-30s %3llu read, %llu dropped, buffer %8zu bytes\n", label.c_str(), (unsigned long long)read,
+               (unsigned long long)connection.GetFramesDropped(), connection.GetInboundCapacity());
+    };
+
+    printf("buffer, cap %s\n", SizeName(FrameCap).c_str());
+    report("connected", 0);
+    for (size_t size : sizes)
+        report("after " + SizeName(size), readAll(LargeJoin(size, 0)));
+    report("after " + SizeName(OverCap), readAll(LargeJoin(OverCap, 0)));
+
+    uint64_t read = 0;
+    for (size_t i = 0; i < SmallFrames; ++i)
+        read += readAll(LargeJoin(256, (int64_t)i));
+    report("after " + std::to_string(SmallFrames) + " small", read);
+
+    connection.Close();
+    report("after close", 0);
+    return connection.GetInboundCapacity() == 0 ? 0 : 1;
+}
+
+} // namespace
+
+int RunFrames(int argc, char** argv)
+{
+    size_t count = (size_t)BenchArg(argc, argv, "count", 64);
+    const std::vector<size_t> sizes = {16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024};
+
+    int result = RunLibrary(sizes, count);
+    return RunBuffer(sizes) | result;
+}
@@ -0,0 +1,284 @@
+/*
+    handoff: the presence hand-off from the caller to the io thread while the io thread hammers
+    the read side, triple buffer against the mutex it replaced.
+
+    The caller's thread sets a serialized typical presence as fast as it can while a reader thread
+    takes the latest value in a loop. Each Set call is timed on its own, and the clock adds about
+    20 ns to every figure. Each is run three ways:
+    - alone: no reader, for the uncontended cost
+    - spinning: the reader takes without pause, so on one core it runs whenever the caller is
+      preempted and is itself preempted anywhere, including inside a lock
+    - interleaved: both sides yield after every call, so the reader takes between most sets
+    The hand-offs:
+    - triple buffer: PresenceEvent, the library's LatestEvent<Buffer>; the reader swaps out the
+      newest slot and reads it in place
+    - before: the event as it was, rebuilt here: Set copies into the shared Buffer under a mutex,
+      the reader exchanges a flag and copies the Buffer out under the same mutex
+    - library: CmdChannel::UpdatePresence, serialization included, over a NullTransport while the
+      reader calls SendData in a loop, as the io thread would if it never slept
+    The reader checks every value it takes: the tag written at both ends of the buffer must match
+    and never go backwards, so a torn or reordered hand-off would be counted.
+*/
+
+#include "bench.h"
+
+#include <cstring>
+#include <mutex>
+
+#include "cmd_channel.h"
+#include "discord_rpc.hpp"
+#include "presence.h"
+#include "rpc_connection.h"
+#include "serialization.h"
+
+namespace
+{
+
+// the hand-off as it was, a mutex around one shared Buffer that both sides copy
+class LegacyPresenceEvent
+{
+    std::atomic_bool awaiting{false};
+    std::mutex mutex;
+    Buffer data;
+    LatencyClock::time_point setTime;
+
+public:
+    void Set(const Buffer& value, LatencyClock::time_point time = LatencyStart())
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        data = value;
+        setTime = time;
+        awaiting = true;
+    }
+
+    bool Consume() { return awaiting.exchange(false); }
+
+    // copies out into the reader's buffer, as SendData's stack Buffer was
+    void Get(Buffer& value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        value = data;
+    }
+};
+
+enum class Reader
+{
+    None,
+    Spinning,
+    Interleaved,
+};
+
+const char* ReaderName(Reader reader)
+{
+    return reader == Reader::None ? "alone" : reader == Reader::Spinning ? "spinning" : "interleaved";
+}
+
+struct ReaderResult
+{
+    uint64_t takes{0};
+    uint64_t torn{0};
+    uint64_t backwards{0};
+    // calls that took a value
+    Samples takeTimes;
+};
+
+void PutTag(Buffer& buffer, uint64_t tag)
+{
+    memcpy(buffer.buffer.get(), &tag, sizeof(tag));
+    memcpy(buffer.buffer.get() + buffer.length - sizeof(tag), &tag, sizeof(tag));
+}
+
+void CheckTag(const char* data, size_t length, uint64_t& last, ReaderResult& result)
+{
+    uint64_t head;
+    uint64_t tail;
+    memcpy(&head, data, sizeof(head));
+    memcpy(&tail, data + length - sizeof(tail), sizeof(tail));
+    ++result.takes;
+    result.torn += head != tail;
+    result.backwards += head < last;
+    last = head;
+}
+
+// runs take in a loop on its own thread until stopped, timing the calls that took something
+class Hammer
+{
+    std::atomic_bool running{true};
+    std::thread thread;
+
+public:
+    Hammer(Reader reader, ReaderResult& result, const std::function<bool()>& take)
+    {
+        if (reader == Reader::None)
+            return;
+        thread = std::thread([this, reader, &result, take] {
+            while (running.load(std::memory_order_relaxed))
+            {
+                auto start = BenchClock::now();
+                if (take())
+                    result.takeTimes.Add(start, BenchClock::now());
+                if (reader == Reader::Interleaved)
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    ~Hammer()
+    {
+        running = false;
+        if (thread.joinable())
+            thread.join();
+    }
+};
+
+// a set that took longer than this was descheduled, and with a lock it may have been waiting on the reader
+constexpr double SlowSetNs = 10000;
+
+struct SetResult
+{
+    Samples samples;
+    size_t slow{0};
+};
+
+SetResult TimeSets(size_t count, Reader reader, const std::function<void(uint64_t)>& set)
+{
+    SetResult result;
+    result.samples.Reserve(count);
+    for (uint64_t i = 1; i <= count; ++i)
+    {
+        auto start = BenchClock::now();
+        set(i);
+        double ns = ElapsedNs(start, BenchClock::now());
+        result.samples.Add(ns);
+        result.slow += ns > SlowSetNs;
+        if (reader == Reader::Interleaved)
+            std::this_thread::yield();
+    }
+    return result;
+}
+
+void Report(const char* name, Reader readerMode, SetResult& sets, ReaderResult& reader, uint64_t overwritten)
+{
+    std::string label = std::string(name) + ", " + ReaderName(readerMode);
+    Samples& samples = sets.samples;
+    printf("%-28s p50=%6.1f p99=%7.1f p999=%8.1f max=%10.1f ns, %5zu over 10 us | %8llu taken, p50 %7.1f ns, %8llu overwritten, "
+           "torn %llu, backwards %llu\n",
+           label.c_str(), samples.Quantile(0.5), samples.Quantile(0.99), samples.Quantile(0.999), samples.Quantile(1.0), sets.slow,
+           (unsigned long long)reader.takes, reader.takes ? reader.takeTimes.Quantile(0.5) : 0.0, (unsigned long long)overwritten,
+           (unsigned long long)reader.torn, (unsigned long long)reader.backwards);
+}
+
+bool RunTripleBuffer(size_t count, const Buffer& serialized, Reader readerMode)
+{
+    auto event = std::make_unique<PresenceEvent>();
+    Buffer value = serialized;
+    ReaderResult reader;
+    uint64_t last = 0;
+    SetResult sets;
+    {
+        Hammer hammer(readerMode, reader, [&] {
+            if (!event->Consume())
+                return false;
+            LatencyClock::time_point setTime;
+            const Buffer& taken = event->Get(setTime);
+            CheckTag(taken.buffer.get(), taken.length, last, reader);
+            return true;
+        });
+        sets = TimeSets(count, readerMode, [&](uint64_t tag) {
+            PutTag(value, tag);
+            event->Set(value);
+        });
+    }
+    Report("triple buffer", readerMode, sets, reader, event->GetOverwritten());
+    return reader.torn == 0 && reader.backwards == 0;
+}
+
+bool RunLegacy(size_t count, const Buffer& serialized, Reader readerMode)
+{
+    LegacyPresenceEvent event;
+    Buffer value = serialized;
+    Buffer taken;
+    ReaderResult reader;
+    uint64_t last = 0;
+    SetResult sets;
+    {
+        Hammer hammer(readerMode, reader, [&] {
+            if (!event.Consume())
+                return false;
+            event.Get(taken);
+            CheckTag(taken.buffer.get(), taken.length, last, reader);
+            return true;
+        });
+        sets = TimeSets(count, readerMode, [&](uint64_t tag) {
+            PutTag(value, tag);
+            event.Set(value);
+        });
+    }
+    // the old event had no counter, every set the reader didn't take was lost to the next one
+    uint64_t overwritten = count - reader.takes - (event.Consume() ? 1 : 0);
+    Report("before", readerMode, sets, reader, overwritten);
+    return reader.torn == 0 && reader.backwards == 0;
+}
+
+bool RunChannel(size_t count, Reader readerMode)
+{
+    auto connection = std::make_unique<RpcConnection>();
+    NullTransport transport;
+    connection->SetApplicationId("100000000000000000");
+    connection->SetTransport(&transport);
+    for (int i = 0; i < 2 && !connection->IsOpen(); ++i)
+        connection->Open();
+    if (!connection->IsOpen())
+    {
+        printf("NullTransport handshake failed\n");
+        return false;
+    }
+
+    auto channel = std::make_unique<CmdChannel>(*connection);
+    CDiscordRichPresence presence = TypicalPresence();
+    // every update differs from the one before so none is skipped as a duplicate
+    std::string states[16];
+    for (size_t i = 0; i < 16; ++i)
+        states[i] = "In a match - round " + std::to_string(i + 1);
+
+    // SendData takes whatever is pending, so only calls that wrote a frame count as takes
+    ReaderResult reader;
+    SetResult sets;
+    {
+        Hammer hammer(readerMode, reader, [&] {
+            uint64_t before = connection->GetFramesWritten();
+            channel->SendData();
+            bool took = connection->GetFramesWritten() != before;
+            reader.takes += took;
+            return took;
+        });
+        sets = TimeSets(count, readerMode, [&](uint64_t i) {
+            presence.state = states[i % 16];
+            channel->UpdatePresence(&presence);
+        });
+    }
+    Report("library", readerMode, sets, reader, channel->GetPresenceOverwritten());
+    return true;
+}
+
+} // namespace
+
+int RunHandoff(int argc, char** argv)
+{
+    size_t count = (size_t)BenchArg(argc, argv, "count", 1000000);
+
+    CDiscordRichPresence presence = TypicalPresence();
+    Buffer serialized;
+    serialized.Reserve(MaxPresenceCommand);
+    serialized.length = JsonWriteRichPresenceObj(serialized.buffer.get(), serialized.capacity, 1, 1234, &presence);
+
+    printf("%zu sets each, %zu-byte presence, ns per Set or UpdatePresence\n", count, serialized.length);
+    bool ok = true;
+    for (Reader reader : {Reader::None, Reader::Spinning, Reader::Interleaved})
+    {
+        ok = RunTripleBuffer(count, serialized, reader) && ok;
+        ok = RunLegacy(count, serialized, reader) && ok;
+        ok = RunChannel(count, reader) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+/*
+    instances: what each extra DiscordRpc instance costs, for 1, 16 and 256 of them.
+
+    Every instance connects to the same socket peer. For each count the bench reports:
+    - threads in the process once all instances are connected, next to the count before any existed
+    - resident memory per instance: the growth of RSS from before creating them to all connected
+    - update latency: one instance at a time, from UpdatePresence until the peer's read carrying
+      that SET_ACTIVITY returns, cycling through the instances
+    - burst: every instance updates at once, time until the last of those frames has arrived
+
+    Without the io thread the bench pumps UpdateConnection on every instance in turn, as a
+    launcher would from its own loop.
+*/
+
+#include "bench.h"
+
+#include <charconv>
+#include <string>
+
+#include "discord_rpc.hpp"
+#include "discord_rpc_impl.h"
+
+namespace
+{
+
+class Instances
+{
+    std::vector<std::unique_ptr<DiscordRpc>> instances;
+
+public:
+    std::atomic_size_t connected{0};
+
+    bool Create(size_t count)
+    {
+        CDiscordEventHandlers handlers;
+        handlers.ready = [this](const CDiscordUser&) { ++connected; };
+        for (size_t i = 0; i < count; ++i)
+        {
+            instances.emplace_back(CreateDiscordRpc());
+            instances.back()->Initialize(std::to_string(100000000000000000 + i), handlers);
+        }
+        return Wait([&] { return connected == count; }, 20000);
+    }
+
+    DiscordRpc* operator[](size_t index) { return instances[index].get(); }
+
+    // spins like WaitFor, pumping every instance
+    bool Wait(const std::function<bool()>& done, int timeoutMs = 5000)
+    {
+        return WaitFor([&] {
+            if (done())
+                return true;
+            for (auto& rpc : instances)
+            {
+                PumpConnection(rpc.get());
+                rpc->RunCallbacks();
+            }
+            return false;
+        }, nullptr, timeoutMs);
+    }
+
+    void Shutdown()
+    {
+        for (auto& rpc : instances)
+            rpc->Shutdown();
+        instances.clear();
+    }
+};
+
+} // namespace
+
+int RunInstances(int argc, char** argv)
+{
+    size_t samples = (size_t)BenchArg(argc, argv, "count", 4096);
+    int idleUs = (int)BenchArg(argc, argv, "idle_us", 200);
+
+    // tags are handed out in order, each frame marks its own arrival
+    std::vector<BenchClock::time_point> arrivals(1 << 20);
+    std::atomic<int64_t> lastArrived{-1};
+    std::atomic_size_t arrived{0};
+    SocketPeer peer;
+    bool started = peer.Start([&](int, uint32_t opcode, std::string_view payload, BenchClock::time_point at) {
+        if (opcode != OpFrame || payload.find("\"SET_ACTIVITY\"") == std::string_view::npos)
+            return;
+        int64_t tag = TaggedNumber(payload, "state");
+        if (tag >= 0 && (size_t)tag < arrivals.size())
+        {
+            arrivals[(size_t)tag] = at;
+            lastArrived = tag;
+            ++arrived;
+        }
+    }, 512);
+    if (!started)
+        return 1;
+
+    printf("%s build, DiscordRpcImpl is %zu bytes inline, %zu latency samples per count, %d us idle between updates\n",
+           BuildName(), sizeof(DiscordRpcImpl), samples, idleUs);
+
+    CDiscordRichPresence presence = TypicalPresence();
+    char state[24] = "#";
+    int64_t nextTag = 0;
+    auto update = [&](DiscordRpc* rpc) {
+        char* end = std::to_chars(state + 1, state + sizeof(state), nextTag++).ptr;
+        presence.state = std::string_view(state, (size_t)(end - state));
+        rpc->UpdatePresence(presence);
+        PumpConnection(rpc);
+    };
+
+    // the first instance also pays for the io thread's stack, the allocator's arenas and
+    // first-touched library code; one that comes and goes beforehand keeps that out of the figures
+    {
+        Instances warmup;
+        if (!warmup.Create(1))
+            return 1;
+        update(warmup[0]);
+        warmup.Wait([&] { return lastArrived == nextTag - 1; });
+        warmup.Shutdown();
+    }
+
+    for (size_t count : {1, 16, 256})
+    {
+        size_t threadsBefore = ThreadCount();
+        size_t rssBefore = ResidentKb();
+
+        Instances instances;
+        if (!instances.Create(count))
+        {
+            printf("%zu instances: only %zu connected\n", count, instances.connected.load());
+            return 1;
+        }
+        // let the subscriptions go out, and every instance send one presence so its buffers are in use
+        for (size_t i = 0; i < count; ++i)
+            update(instances[i]);
+        instances.Wait([&] { return lastArrived == nextTag - 1; });
+        size_t threads = ThreadCount();
+        double rssPerInstance = (double)ResidentKb() - (double)rssBefore;
+        rssPerInstance /= (double)count;
+
+        Samples single;
+        single.Reserve(samples);
+        for (size_t i = 0; i < samples; ++i)
+        {
+            int64_t tag = nextTag;
+            auto start = BenchClock::now();
+            update(instances[i % count]);
+            if (!instances.Wait([&] { return lastArrived >= tag; }))
+            {
+                printf("%zu instances: update %lld never arrived\n", count, (long long)tag);
+                return 1;
+            }
+            single.Add(start, arrivals[(size_t)tag]);
+            std::this_thread::sleep_for(std::chrono::microseconds(idleUs));
+        }
+
+        Samples burst;
+        size_t bursts = std::max<size_t>(16, samples / count);
+        burst.Reserve(bursts);
+        for (size_t b = 0; b < bursts; ++b)
+        {
+            size_t arrivedBefore = arrived;
+            auto start = BenchClock::now();
+            for (size_t i = 0; i < count; ++i)
+                update(instances[i]);
+            if (!instances.Wait([&] { return arrived - arrivedBefore >= count; }))
+            {
+                printf("%zu instances: burst %zu incomplete\n", count, b);
+                return 1;
+            }
+            burst.Add(start, arrivals[(size_t)lastArrived.load()]);
+            std::this_thread::sleep_for(std::chrono::microseconds(idleUs));
+        }
+
+        printf("%4zu instances: threads %zu (%zu before), RSS %.1f KB per instance\n", count, threads, threadsBefore, rssPerInstance);
+        single.Report("  one update UpdatePresence->peer");
+        burst.Report("  all update at once, until the last arrives");
+        instances.Shutdown();
+    }
+    return 0;
+}
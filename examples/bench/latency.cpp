@@ -0,0 +1,126 @@
+/*
+    latency: end to end delivery through a unix socket peer.
+
+    presence: from the UpdatePresence call until the read carrying its SET_ACTIVITY frame
+    returns at the peer. Each update waits for the previous one to arrive, then the caller idles
+    for a moment, so this is the cost of waking up for a lone update, not of a backlog.
+    join: from the peer sending ACTIVITY_JOIN until joinGame fires inside RunCallbacks, which
+    the caller runs in a loop.
+
+    Without the io thread the caller pumps UpdateConnection right after UpdatePresence and
+    before every RunCallbacks, the best a game loop can do.
+*/
+
+#include "bench.h"
+
+#include <charconv>
+#include <string>
+
+#include "discord_rpc.hpp"
+
+static void MeasurePresence(DiscordRpc* rpc, std::vector<BenchClock::time_point>& arrivals,
+                            std::atomic<int64_t>& lastArrived, size_t count, int idleUs, const char* label)
+{
+    arrivals.assign(count, {});
+    lastArrived = -1;
+
+    Samples samples;
+    samples.Reserve(count);
+    CDiscordRichPresence presence;
+    presence.details = "Benchmarking";
+    presence.largeImageKey = "bench";
+    presence.startTimestamp = 1700000000;
+    char state[24] = "#";
+    for (size_t i = 0; i < count; ++i)
+    {
+        char* end = std::to_chars(state + 1, state + sizeof(state), i).ptr;
+        presence.state = std::string_view(state, (size_t)(end - state));
+
+        auto start = BenchClock::now();
+        rpc->UpdatePresence(presence);
+        PumpConnection(rpc);
+        if (!WaitFor([&] { return lastArrived.load() >= (int64_t)i; }, rpc))
+        {
+            printf("%s: update %zu never arrived\n", label, i);
+            return;
+        }
+        samples.Add(start, arrivals[i]);
+        std::this_thread::sleep_for(std::chrono::microseconds(idleUs));
+    }
+    samples.Report(label);
+}
+
+int RunLatency(int argc, char** argv)
+{
+    size_t count = (size_t)BenchArg(argc, argv, "count", 10000);
+    int idleUs = (int)BenchArg(argc, argv, "idle_us", 200);
+
+    std::vector<BenchClock::time_point> arrivals;
+    std::atomic<int64_t> lastArrived{-1};
+    SocketPeer peer;
+    bool started = peer.Start([&](int, uint32_t opcode, std::string_view payload, BenchClock::time_point arrived) {
+        if (opcode != OpFrame || payload.find("\"SET_ACTIVITY\"") == std::string_view::npos)
+            return;
+        int64_t tag = TaggedNumber(payload, "state");
+        if (tag >= 0 && (size_t)tag < arrivals.size())
+        {
+            arrivals[(size_t)tag] = arrived;
+            lastArrived = tag;
+        }
+    });
+    if (!started)
+        return 1;
+
+    std::atomic_bool connected{false};
+    std::atomic<int64_t> lastJoin{-1};
+    BenchClock::time_point joinFired;
+    CDiscordEventHandlers handlers;
+    handlers.ready = [&](const CDiscordUser&) { connected = true; };
+    handlers.joinGame = [&](const std::string_view& secret) {
+        joinFired = BenchClock::now();
+        std::string tagged = "{\"secret\":\"" + std::string(secret) + "\"}";
+        lastJoin = TaggedNumber(tagged, "secret");
+    };
+
+    DiscordRpc* rpc = CreateDiscordRpc();
+    rpc->Initialize("100000000000000000", handlers);
+    if (!WaitFor([&] { return connected.load(); }, rpc))
+    {
+        printf("no connection to the bench peer\n");
+        return 1;
+    }
+    // let the subscription for ACTIVITY_JOIN go out before timing anything
+    WaitFor([&] { return false; }, rpc, 50);
+
+    printf("%s build, %zu samples each, %d us idle between updates\n", BuildName(), count, idleUs);
+    MeasurePresence(rpc, arrivals, lastArrived, count, idleUs, "presence UpdatePresence->peer");
+    rpc->SetDirectSend(true);
+    MeasurePresence(rpc, arrivals, lastArrived, count, idleUs, "presence direct send UpdatePresence->peer");
+    rpc->SetDirectSend(false);
+
+    Samples join;
+    join.Reserve(count);
+    std::string message;
+    for (size_t i = 0; i < count; ++i)
+    {
+        message = "{\"cmd\":\"DISPATCH\",\"data\":{\"secret\":\"#" + std::to_string(i) + "\"},\"evt\":\"ACTIVITY_JOIN\",\"nonce\":null}";
+        auto sent = peer.Send(0, OpFrame, message);
+        if (!WaitFor([&] { return lastJoin.load() >= (int64_t)i; }, rpc))
+        {
+            printf("join %zu never fired\n", i);
+            break;
+        }
+        join.Add(sent, joinFired);
+        std::this_thread::sleep_for(std::chrono::microseconds(idleUs));
+    }
+    join.Report("join peer->joinGame");
+
+    auto stats = rpc->GetStatistics();
+    printf("io wakeups %llu, frames sent %llu in %llu writes, frames received %llu in %llu reads\n",
+           (unsigned long long)stats.ioWakeups, (unsigned long long)stats.framesSent, (unsigned long long)stats.sendCalls,
+           (unsigned long long)stats.framesReceived, (unsigned long long)stats.receiveCalls);
+
+    rpc->Shutdown();
+    delete rpc;
+    return 0;
+}
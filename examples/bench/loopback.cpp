@@ -0,0 +1,242 @@
+/*
+    loopback: serialization, framing and event dispatch over the in-memory LoopbackTransport.
+
+    The library's RpcConnection, CmdChannel and EventChannel run on the bench thread against one
+    end of a loopback pair; a peer thread on the other end answers the handshake, checks every
+    SET_ACTIVITY it reads and streams ACTIVITY_JOIN frames back. No kernel and no socket files are
+    involved, so this is what the library itself sustains per core:
+    - outbound: UpdatePresence and SendData per update until the peer has read them all
+    - inbound: a stream of ACTIVITY_JOIN frames through ReceiveData and RunCallbacks
+    - soak: both at once for a while, every frame checked for order and content
+*/
+
+#include "bench.h"
+
+#include <charconv>
+
+#include "cmd_channel.h"
+#include "discord_rpc.hpp"
+#include "event_channel.h"
+#include "loopback_transport.h"
+#include "rpc_connection.h"
+
+namespace
+{
+
+class LoopbackPeer
+{
+    LoopbackTransport& end;
+    std::thread thread;
+    std::atomic_bool running{true};
+    std::string pending;
+    std::string outgoing;
+    size_t outgoingOffset{0};
+
+public:
+    // presence frames read so far and the newest state tag among them; tags only ever grow,
+    // with gaps where the library replaced an update that hadn't gone out yet
+    std::atomic_uint64_t presenceFrames{0};
+    std::atomic<int64_t> lastState{-1};
+    std::atomic_uint64_t presenceBytes{0};
+    std::atomic_uint64_t errors{0};
+    // ACTIVITY_JOIN frames to have sent in total, set by the bench, and sent so far
+    std::atomic_uint64_t joinTarget{0};
+    std::atomic_uint64_t joinsSent{0};
+    std::atomic_uint64_t joinBytes{0};
+
+    explicit LoopbackPeer(LoopbackTransport& end) : end(end) { thread = std::thread(&LoopbackPeer::Run, this); }
+
+    ~LoopbackPeer()
+    {
+        running = false;
+        thread.join();
+    }
+
+private:
+    void HandleFrame(uint32_t opcode, std::string_view payload)
+    {
+        if (opcode == OpHandshake)
+        {
+            std::string frame;
+            SocketPeer::AppendFrame(frame, OpFrame,
+                                    "{\"cmd\":\"DISPATCH\",\"data\":{\"v\":1,\"user\":{\"id\":\"1\",\"username\":\"bench\","
+                                    "\"discriminator\":\"0001\",\"avatar\":null}},\"evt\":\"READY\",\"nonce\":null}");
+            outgoing += frame;
+            return;
+        }
+        if (payload.find("\"SET_ACTIVITY\"") == std::string_view::npos)
+            return;
+
+        // anything else means a frame was reordered or garbled
+        int64_t tag = TaggedNumber(payload, "state");
+        if (tag <= lastState || payload.back() != '}')
+            ++errors;
+        lastState = tag;
+        presenceBytes += 8 + payload.size();
+        ++presenceFrames;
+    }
+
+    void Run()
+    {
+        char buffer[64 * 1024];
+        std::string join;
+        while (running)
+        {
+            bool idle = true;
+            size_t read = end.Read(buffer, sizeof(buffer));
+            if (read)
+            {
+                idle = false;
+                pending.append(buffer, read);
+                size_t offset = 0;
+                while (size_t size = ipcCompleteFrame(pending.data() + offset, pending.size() - offset))
+                {
+                    const char* frame = pending.data() + offset;
+                    HandleFrame(ipcFrameOpcode(frame), std::string_view(frame + IPC_HEADER_SIZE, size - IPC_HEADER_SIZE));
+                    offset += size;
+                }
+                pending.erase(0, offset);
+            }
+
+            // keep some join frames ready to go
+            while (joinsSent < joinTarget && outgoing.size() - outgoingOffset < 16 * 1024)
+            {
+                join = "{\"cmd\":\"DISPATCH\",\"data\":{\"secret\":\"#" + std::to_string(joinsSent) +
+                       "\"},\"evt\":\"ACTIVITY_JOIN\",\"nonce\":null}";
+                SocketPeer::AppendFrame(outgoing, OpFrame, join);
+                joinBytes += 8 + join.size();
+                ++joinsSent;
+            }
+
+            if (outgoingOffset < outgoing.size())
+            {
+                size_t written = end.Write(outgoing.data() + outgoingOffset, outgoing.size() - outgoingOffset);
+                outgoingOffset += written;
+                idle = idle && written == 0;
+                if (outgoingOffset == outgoing.size())
+                {
+                    outgoing.clear();
+                    outgoingOffset = 0;
+                }
+            }
+
+            if (idle)
+                std::this_thread::yield();
+        }
+    }
+};
+
+struct LoopbackClient
+{
+    RpcConnection connection;
+    CmdChannel commands{connection};
+    EventChannel events{connection, commands};
+    std::atomic<int64_t> lastJoin{-1};
+
+    bool Connect(LoopbackTransport& end)
+    {
+        CDiscordEventHandlers handlers;
+        handlers.joinGame = [this](const std::string_view& secret) {
+            std::string tagged = "{\"secret\":\"" + std::string(secret) + "\"}";
+            lastJoin = TaggedNumber(tagged, "secret");
+        };
+        events.SetHandlers(handlers);
+
+        connection.SetApplicationId("100000000000000000");
+        connection.SetTransport(&end);
+        return WaitFor([&] {
+            connection.Open();
+            return connection.IsOpen();
+        });
+    }
+};
+
+void Rate(const char* label, uint64_t frames, uint64_t bytes, double ns)
+{
+    printf("%-10s %10llu frames in %8.1f ms: %10.0f frames/s %8.1f MB/s\n", label, (unsigned long long)frames, ns / 1e6,
+           (double)frames * 1e9 / ns, (double)bytes * 1e3 / ns);
+}
+
+} // namespace
+
+int RunLoopback(int argc, char** argv)
+{
+    uint64_t count = (uint64_t)BenchArg(argc, argv, "count", 1000000);
+    int64_t soakMs = BenchArg(argc, argv, "soak_ms", 2000);
+
+    auto ends = LoopbackTransport::CreatePair();
+    ends.second->Open();
+    LoopbackPeer peer(*ends.second);
+    auto client = std::make_unique<LoopbackClient>();
+    if (!client->Connect(*ends.first))
+    {
+        printf("loopback handshake failed\n");
+        return 1;
+    }
+
+    CDiscordRichPresence presence = TypicalPresence();
+    char state[24] = "#";
+    uint64_t nextState = 0;
+    auto update = [&] {
+        char* end = std::to_chars(state + 1, state + sizeof(state), nextState++).ptr;
+        presence.state = std::string_view(state, (size_t)(end - state));
+        client->commands.UpdatePresence(&presence);
+        client->commands.SendData();
+    };
+
+    auto start = BenchClock::now();
+    for (uint64_t i = 0; i < count; ++i)
+        update();
+    WaitFor([&] {
+        client->commands.SendData();
+        return peer.lastState == (int64_t)count - 1;
+    });
+    double outboundNs = ElapsedNs(start, BenchClock::now());
+    Rate("outbound", peer.presenceFrames, peer.presenceBytes, outboundNs);
+
+    // frames arrive in order, so once the last secret reached joinGame every join was read
+    start = BenchClock::now();
+    peer.joinTarget = count;
+    bool inbound = WaitFor([&] {
+        client->events.ReceiveData();
+        client->events.RunCallbacks();
+        return client->lastJoin == (int64_t)count - 1;
+    }, nullptr, 60000);
+    double inboundNs = ElapsedNs(start, BenchClock::now());
+    Rate("inbound", count, peer.joinBytes, inboundNs);
+    if (!inbound)
+        ++peer.errors;
+
+    // both directions at once
+    uint64_t presenceBefore = peer.presenceFrames;
+    uint64_t bytesBefore = peer.presenceBytes + peer.joinBytes;
+    start = BenchClock::now();
+    auto deadline = start + std::chrono::milliseconds(soakMs);
+    while (BenchClock::now() < deadline)
+    {
+        // keeps a few joins in flight
+        if (peer.joinTarget - peer.joinsSent < 64)
+            peer.joinTarget += 64;
+        update();
+        client->events.ReceiveData();
+        client->events.RunCallbacks();
+    }
+    uint64_t joinsSent = peer.joinTarget;
+    WaitFor([&] {
+        client->commands.SendData();
+        client->events.ReceiveData();
+        client->events.RunCallbacks();
+        return peer.lastState == (int64_t)nextState - 1 && client->lastJoin == (int64_t)joinsSent - 1;
+    });
+    double soakNs = ElapsedNs(start, BenchClock::now());
+    uint64_t soakFrames = (peer.presenceFrames - presenceBefore) + (joinsSent - count);
+    Rate("soak", soakFrames, peer.presenceBytes + peer.joinBytes - bytesBefore, soakNs);
+    if (client->lastJoin != (int64_t)joinsSent - 1 || peer.lastState != (int64_t)nextState - 1 || !client->connection.IsOpen())
+        ++peer.errors;
+
+    printf("errors: %llu (lost, reordered or garbled frames, or a dropped connection), updates replaced before sending: %llu, "
+           "write stalls: %llu\n",
+           (unsigned long long)peer.errors, (unsigned long long)client->commands.GetPresenceOverwritten(),
+           (unsigned long long)client->connection.GetWriteStalls());
+    return peer.errors ? 1 : 0;
+}
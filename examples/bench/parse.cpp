@@ -0,0 +1,288 @@
+/*
+    parse: what an incoming frame costs from the transport to its event slot, streaming
+    reader against a DOM.
+
+    The library's EventChannel::ReceiveData picks the members it needs out of each frame with
+    a streaming reader. The DOM path is rebuilt here from the code it replaced: each frame is
+    parsed into a fresh JsonDocument, then evt and data are looked up by name and compared
+    against each event name in turn. Both read the same frames through an RpcConnection over a
+    NullTransport and set the same event slots, in batches of 8 that are drained between
+    batches without being timed.
+    The DOM path also runs with one JsonDocument kept across frames, the way RpcConnection keeps
+    its own for READY and close frames. Heap allocations per frame are counted for all three on
+    glibc, where malloc, calloc and realloc are wrapped around __libc_malloc and its siblings.
+    - join: ACTIVITY_JOIN with a secret
+    - join request: ACTIVITY_JOIN_REQUEST with a user object
+    - error: ERROR with a code and message
+    - reply: the client's answer to SET_ACTIVITY, which echoes the activity and dispatches
+      nothing; the most common inbound frame
+*/
+
+#include "bench.h"
+
+#include "cmd_channel.h"
+#include "discord_rpc.hpp"
+#include "event_channel.h"
+#include "events.h"
+#include "msg_queue.h"
+#include "rpc_connection.h"
+#include "serialization.h"
+
+#include <optional>
+
+#ifdef __GLIBC__
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+namespace
+{
+std::atomic_uint64_t heapAllocations{0};
+}
+
+// counts for the whole process, operator new included; the bench reads it around the calls it times
+extern "C" void* malloc(size_t size) noexcept
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) noexcept
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+namespace
+{
+
+constexpr size_t BatchFrames = 8;
+
+// heap allocations so far, 0 where they aren't counted
+uint64_t HeapAllocations()
+{
+#ifdef __GLIBC__
+    return heapAllocations.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+// the event slots the DOM path fills, the same types EventChannel uses
+struct DomEvents
+{
+    ErrorEvent onError;
+    JoinGameEvent onJoinGame;
+    SpectateGameEvent onSpectateGame;
+    MsgQueue<User, 8> joinAskQueue;
+
+    void Drain()
+    {
+        onError.Consume();
+        onJoinGame.Consume();
+        onSpectateGame.Consume();
+        while (joinAskQueue.HavePendingSends())
+        {
+            joinAskQueue.GetNextSendMessage();
+            joinAskQueue.CommitSend();
+        }
+    }
+};
+
+bool DeserializeUser(JsonValue* data, User& user)
+{
+    auto* member = GetObjMember(data, "user");
+    auto* userId = GetStrMember(member, "id");
+    auto* username = GetStrMember(member, "username");
+    if (!userId || !username)
+        return false;
+
+    user.userId = userId;
+    user.username = username;
+    auto* discriminator = GetStrMember(member, "discriminator");
+    if (discriminator)
+        user.discriminator = discriminator;
+    auto* avatar = GetStrMember(member, "avatar");
+    if (avatar)
+        user.avatar = avatar;
+    else
+        user.avatar.clear();
+    return true;
+}
+
+// a fresh document per frame as the replaced code did, or the one given for every frame
+void DomReceiveData(RpcConnection& connection, DomEvents& events, JsonDocument* reused = nullptr)
+{
+    for (;;)
+    {
+        std::optional<JsonDocument> fresh;
+        JsonDocument& message = reused ? *reused : fresh.emplace();
+        if (!connection.Read(message))
+            break;
+
+        auto* evtName = GetStrMember(&message, "evt");
+        auto* data = GetObjMember(&message, "data");
+        if (!evtName || !data)
+            continue;
+        std::string_view eventName = evtName;
+
+        if (eventName == "ERROR")
+            events.onError.Set(GetIntMember(data, "code"), GetStrMember(data, "message", ""));
+        else if (eventName == "ACTIVITY_JOIN")
+        {
+            auto* secret = GetStrMember(data, "secret");
+            if (secret)
+                events.onJoinGame.Set(secret);
+        }
+        else if (eventName == "ACTIVITY_SPECTATE")
+        {
+            auto* secret = GetStrMember(data, "secret");
+            if (secret)
+                events.onSpectateGame.Set(secret);
+        }
+        else if (eventName == "ACTIVITY_JOIN_REQUEST")
+        {
+            // a claimed slot can't be given back, so the user is read before one is claimed
+            User user;
+            auto* joinReq = DeserializeUser(data, user) ? events.joinAskQueue.GetNextAddMessage() : nullptr;
+            if (joinReq)
+            {
+                *joinReq = user;
+                events.joinAskQueue.CommitAdd(joinReq);
+            }
+        }
+    }
+}
+
+struct Reader
+{
+    NullTransport transport;
+    RpcConnection connection;
+    CmdChannel commands{connection};
+    EventChannel events{connection, commands};
+
+    bool Open()
+    {
+        connection.SetApplicationId("100000000000000000");
+        connection.SetTransport(&transport);
+        for (int i = 0; i < 2 && !connection.IsOpen(); ++i)
+            connection.Open();
+        return connection.IsOpen();
+    }
+};
+
+struct FrameCost
+{
+    double ns;
+    double allocations;
+};
+
+// per frame, counting only the receive calls
+template <typename Receive, typename Drain>
+FrameCost CostPerFrame(NullTransport& transport, const std::string& batch, size_t frames, Receive receive, Drain drain)
+{
+    double ns = 0;
+    uint64_t allocations = 0;
+    for (size_t i = 0; i < frames / BatchFrames; ++i)
+    {
+        transport.Feed(batch);
+        uint64_t allocationsBefore = HeapAllocations();
+        auto start = BenchClock::now();
+        receive();
+        ns += ElapsedNs(start, BenchClock::now());
+        allocations += HeapAllocations() - allocationsBefore;
+        drain();
+    }
+    double timed = (double)(frames / BatchFrames * BatchFrames);
+    return {ns / timed, (double)allocations / timed};
+}
+
+} // namespace
+
+int RunParse(int argc, char** argv)
+{
+    size_t count = (size_t)BenchArg(argc, argv, "count", 1000000);
+
+    struct Case
+    {
+        const char* name;
+        std::string payload;
+    };
+    const Case cases[] = {
+        {"join", "{\"cmd\":\"DISPATCH\",\"data\":{\"secret\":\"025ed05c71f639de8bfaa0d679d7c94b2fdce12f\"},"
+                 "\"evt\":\"ACTIVITY_JOIN\",\"nonce\":null}"},
+        {"join request", "{\"cmd\":\"DISPATCH\",\"data\":{\"user\":{\"id\":\"53908232506183680\",\"username\":\"Mason\","
+                         "\"discriminator\":\"1337\",\"avatar\":\"a_bab14f271d565501444b2ca3be944b25\"}},"
+                         "\"evt\":\"ACTIVITY_JOIN_REQUEST\",\"nonce\":null}"},
+        {"error", "{\"cmd\":\"DISPATCH\",\"data\":{\"code\":4000,\"message\":\"Invalid Client ID\"},\"evt\":\"ERROR\",\"nonce\":null}"},
+        {"reply", "{\"cmd\":\"SET_ACTIVITY\",\"data\":{\"state\":\"In a match - round 1\",\"details\":\"Ranked 5v5 on Harbor, 3 - 2\","
+                  "\"timestamps\":{\"start\":1700000000000},\"assets\":{\"large_image\":\"map_harbor\",\"large_text\":\"Harbor (night)\","
+                  "\"small_image\":\"rank_gold\",\"small_text\":\"Gold III\"},\"party\":{\"id\":\"ae488379-351d-4a4f-ad32-2b9b01c91657\","
+                  "\"size\":[3,5]},\"name\":\"Bench\",\"application_id\":\"100000000000000000\",\"type\":0,\"flags\":0,"
+                  "\"instance\":false},\"evt\":null,\"nonce\":\"12\"}"},
+    };
+
+    Reader library;
+    Reader dom;
+    Reader reused;
+    Reader framing;
+    if (!library.Open() || !dom.Open() || !reused.Open() || !framing.Open())
+    {
+        printf("NullTransport handshake failed\n");
+        return 1;
+    }
+    // handlers for every event, so all of them are dispatched
+    CDiscordEventHandlers handlers;
+    handlers.errored = [](int, const std::string_view&) {};
+    handlers.joinGame = [](const std::string_view&) {};
+    handlers.spectateGame = [](const std::string_view&) {};
+    handlers.joinRequest = [](const CDiscordUser&) {};
+    library.events.SetHandlers(handlers);
+    DomEvents domEvents;
+    DomEvents reusedEvents;
+    JsonDocument document;
+
+    printf("%zu frames each, in batches of %zu; allocs are heap allocations per frame\n", count, BatchFrames);
+    printf("%-14s %8s %14s %14s %14s %14s %14s %6s %6s %6s\n", "frame", "bytes", "read ns/frame", "dom ns/frame",
+           "reused ns/frame", "stream ns/frame", "parse speedup", "dom", "reused", "stream");
+    for (auto& c : cases)
+    {
+        std::string batch;
+        for (size_t i = 0; i < BatchFrames; ++i)
+            SocketPeer::AppendFrame(batch, OpFrame, c.payload);
+
+        // warm up both, then time
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            size_t frames = pass ? count : count / 10;
+            auto streamCost = CostPerFrame(library.transport, batch, frames, [&] { library.events.ReceiveData(); },
+                                           [&] { library.events.RunCallbacks(); });
+            auto domCost = CostPerFrame(dom.transport, batch, frames, [&] { DomReceiveData(dom.connection, domEvents); },
+                                        [&] { domEvents.Drain(); });
+            auto reusedCost = CostPerFrame(reused.transport, batch, frames,
+                                           [&] { DomReceiveData(reused.connection, reusedEvents, &document); },
+                                           [&] { reusedEvents.Drain(); });
+            if (library.transport.Unread() || dom.transport.Unread() || reused.transport.Unread())
+                printf("%s: frames left unread\n", c.name);
+            // framing and copying alone, what every path pays before parsing
+            double readNs = CostPerFrame(framing.transport, batch, frames, [&] {
+                char* frame;
+                size_t length;
+                while (framing.connection.Read(frame, length))
+                    ;
+            }, [] {}).ns;
+            if (pass)
+                printf("%-14s %8zu %14.1f %14.1f %14.1f %14.1f %13.1fx %6.2f %6.2f %6.2f\n", c.name, c.payload.size(),
+                       readNs, domCost.ns, reusedCost.ns, streamCost.ns, (domCost.ns - readNs) / (streamCost.ns - readNs),
+                       domCost.allocations, reusedCost.allocations, streamCost.allocations);
+        }
+    }
+    return 0;
+}
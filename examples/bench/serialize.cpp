@@ -0,0 +1,215 @@
+/*
+    serialize: SET_ACTIVITY serialization, the library's fragment writer against the rapidjson
+    Writer it replaced.
+
+    The writer path is rebuilt here from the code it replaced: a rapidjson Writer over a
+    DirectStringBuffer with a 2 KB stack allocator, constructed per call, writing key by key.
+    Both serialize the same presences into the same buffer:
+    - typical: what games send, about 380 bytes
+    - full: every string field at its length limit, timestamps, party and secrets
+    - escaped: the typical presence with quotes, backslashes and a newline in the text fields
+*/
+
+#include "bench.h"
+
+#include <charconv>
+
+#include "rapidjson/writer.h"
+
+#include "discord_rpc.hpp"
+#include "serialization.h"
+
+namespace
+{
+
+class DirectStringBuffer
+{
+public:
+    using Ch = char;
+    char* buffer;
+    char* end;
+    char* current;
+
+    DirectStringBuffer(char* buffer, size_t maxLen) : buffer(buffer), end(buffer + maxLen), current(buffer) {}
+
+    void Put(char c)
+    {
+        if (current < end)
+            *current++ = c;
+    }
+
+    void Flush() {}
+    size_t GetSize() const { return (size_t)(current - buffer); }
+};
+
+constexpr size_t WriterNestingLevels = 2048 / (2 * sizeof(size_t));
+
+using JsonWriterBase = rapidjson::Writer<DirectStringBuffer, UTF8, UTF8, StackAllocator>;
+class JsonWriter : public JsonWriterBase
+{
+public:
+    DirectStringBuffer stringBuffer;
+    StackAllocator stackAlloc;
+
+    JsonWriter(char* dest, size_t maxLen) : JsonWriterBase(stringBuffer, &stackAlloc, WriterNestingLevels), stringBuffer(dest, maxLen), stackAlloc() {}
+
+    size_t Size() const { return stringBuffer.GetSize(); }
+};
+
+template <typename T>
+void WriteKey(JsonWriter& w, T& k)
+{
+    w.Key(k, sizeof(T) - 1);
+}
+
+template <typename T>
+void WriteOptionalString(JsonWriter& w, T& k, const std::string_view& value)
+{
+    if (!value.empty())
+    {
+        w.Key(k, sizeof(T) - 1);
+        w.String(value.data(), (uint32_t)value.size());
+    }
+}
+
+size_t WriterRichPresenceObj(char* dest, size_t maxLen, int nonce, int pid, const CDiscordRichPresence* presence)
+{
+    JsonWriter writer(dest, maxLen);
+    char nonceBuffer[32];
+    *std::to_chars(nonceBuffer, nonceBuffer + sizeof(nonceBuffer) - 1, nonce).ptr = 0;
+
+    writer.StartObject();
+    WriteKey(writer, "nonce");
+    writer.String(nonceBuffer);
+    WriteKey(writer, "cmd");
+    writer.String("SET_ACTIVITY");
+    WriteKey(writer, "args");
+    writer.StartObject();
+    WriteKey(writer, "pid");
+    writer.Int(pid);
+    if (presence != nullptr)
+    {
+        WriteKey(writer, "activity");
+        writer.StartObject();
+        WriteOptionalString(writer, "state", presence->state);
+        WriteOptionalString(writer, "details", presence->details);
+        if (presence->startTimestamp || presence->endTimestamp)
+        {
+            WriteKey(writer, "timestamps");
+            writer.StartObject();
+            if (presence->startTimestamp)
+            {
+                WriteKey(writer, "start");
+                writer.Int64(presence->startTimestamp);
+            }
+            if (presence->endTimestamp)
+            {
+                WriteKey(writer, "end");
+                writer.Int64(presence->endTimestamp);
+            }
+            writer.EndObject();
+        }
+        if (!presence->largeImageKey.empty() || !presence->largeImageText.empty() || !presence->smallImageKey.empty() ||
+            !presence->smallImageText.empty())
+        {
+            WriteKey(writer, "assets");
+            writer.StartObject();
+            WriteOptionalString(writer, "large_image", presence->largeImageKey);
+            WriteOptionalString(writer, "large_text", presence->largeImageText);
+            WriteOptionalString(writer, "small_image", presence->smallImageKey);
+            WriteOptionalString(writer, "small_text", presence->smallImageText);
+            writer.EndObject();
+        }
+        if (!presence->partyId.empty() || presence->partySize || presence->partyMax || presence->partyPrivacy)
+        {
+            WriteKey(writer, "party");
+            writer.StartObject();
+            WriteOptionalString(writer, "id", presence->partyId);
+            if (presence->partySize && presence->partyMax)
+            {
+                WriteKey(writer, "size");
+                writer.StartArray();
+                writer.Int(presence->partySize);
+                writer.Int(presence->partyMax);
+                writer.EndArray();
+            }
+            if (presence->partyPrivacy)
+            {
+                WriteKey(writer, "privacy");
+                writer.Int(presence->partyPrivacy);
+            }
+            writer.EndObject();
+        }
+        if (!presence->matchSecret.empty() || !presence->joinSecret.empty() || !presence->spectateSecret.empty())
+        {
+            WriteKey(writer, "secrets");
+            writer.StartObject();
+            WriteOptionalString(writer, "match", presence->matchSecret);
+            WriteOptionalString(writer, "join", presence->joinSecret);
+            WriteOptionalString(writer, "spectate", presence->spectateSecret);
+            writer.EndObject();
+        }
+        writer.Key("instance");
+        writer.Bool(presence->instance != 0);
+        writer.EndObject();
+    }
+    writer.EndObject();
+    writer.EndObject();
+    return writer.Size();
+}
+
+} // namespace
+
+int RunSerialize(int argc, char** argv)
+{
+    size_t count = (size_t)BenchArg(argc, argv, "count", 1000000);
+
+    std::string limit128(128, 'x');
+    std::string limit32(32, 'k');
+    CDiscordRichPresence full;
+    full.state = full.details = full.largeImageText = full.smallImageText = full.partyId = limit128;
+    full.matchSecret = full.joinSecret = full.spectateSecret = limit128;
+    full.largeImageKey = full.smallImageKey = limit32;
+    full.startTimestamp = 1700000000;
+    full.endTimestamp = 1700003600;
+    full.partySize = 3;
+    full.partyMax = 5;
+    full.partyPrivacy = DISCORD_PARTY_PUBLIC;
+    full.instance = 1;
+
+    CDiscordRichPresence escaped = TypicalPresence();
+    escaped.state = "In a match - \"round\" 1";
+    escaped.details = "Ranked 5v5 on C:\\maps\\harbor\n3 - 2";
+    escaped.largeImageText = "Harbor \"night\"";
+
+    struct Case
+    {
+        const char* name;
+        CDiscordRichPresence presence;
+    };
+    const Case cases[] = {{"typical", TypicalPresence()}, {"full", full}, {"escaped", escaped}};
+
+    static char buffer[16 * 1024];
+    // the first figures of a run come out high until the core has settled in
+    for (size_t i = 0; i < count; ++i)
+        JsonWriteRichPresenceObj(buffer, sizeof(buffer), (int)i, 1234, &cases[i % 3].presence);
+
+    printf("%zu calls each\n", count);
+    printf("%-10s %8s %16s %16s %8s\n", "presence", "bytes", "writer ns/call", "library ns/call", "speedup");
+    for (auto& c : cases)
+    {
+        size_t writerBytes = 0;
+        size_t libraryBytes = 0;
+        double writerNs = NsPerIteration(count, [&](size_t i) {
+            writerBytes = WriterRichPresenceObj(buffer, sizeof(buffer), (int)i, 1234, &c.presence);
+        });
+        double libraryNs = NsPerIteration(count, [&](size_t i) {
+            libraryBytes = JsonWriteRichPresenceObj(buffer, sizeof(buffer), (int)i, 1234, &c.presence);
+        });
+        // same members, only the nonce moved
+        if (writerBytes != libraryBytes)
+            printf("%s: writer wrote %zu bytes, library %zu\n", c.name, writerBytes, libraryBytes);
+        printf("%-10s %8zu %16.1f %16.1f %7.1fx\n", c.name, libraryBytes, writerNs, libraryNs, writerNs / libraryNs);
+    }
+    return 0;
+}
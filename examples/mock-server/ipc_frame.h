@@ -0,0 +1,64 @@
+/*
+    Framing of the Discord IPC socket, shared by the mock server and the bench so that both
+    build and split frames the same way.
+
+    A frame is an 8-byte header, the opcode then the payload length, each a little-endian
+    uint32, followed by the payload. Plain C so the mock server can include it as well.
+*/
+
+#ifndef DISCORD_RPC_IPC_FRAME_H
+#define DISCORD_RPC_IPC_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define IPC_HEADER_SIZE 8
+
+enum IpcOpcode {
+    IPC_OP_HANDSHAKE = 0,
+    IPC_OP_FRAME = 1,
+    IPC_OP_CLOSE = 2,
+    IPC_OP_PING = 3,
+    IPC_OP_PONG = 4,
+};
+
+static inline void ipcPutUint32(char* dest, uint32_t value)
+{
+    dest[0] = (char)(value & 0xff);
+    dest[1] = (char)((value >> 8) & 0xff);
+    dest[2] = (char)((value >> 16) & 0xff);
+    dest[3] = (char)((value >> 24) & 0xff);
+}
+
+static inline uint32_t ipcGetUint32(const char* src)
+{
+    const unsigned char* s = (const unsigned char*)src;
+    return (uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24);
+}
+
+static inline void ipcPutHeader(char* dest, uint32_t opcode, uint32_t length)
+{
+    ipcPutUint32(dest, opcode);
+    ipcPutUint32(dest + 4, length);
+}
+
+static inline uint32_t ipcFrameOpcode(const char* frame)
+{
+    return ipcGetUint32(frame);
+}
+
+static inline uint32_t ipcFrameLength(const char* frame)
+{
+    return ipcGetUint32(frame + 4);
+}
+
+/* header and payload of the frame at data if all of it is there, otherwise 0 */
+static inline size_t ipcCompleteFrame(const char* data, size_t available)
+{
+    if (available < IPC_HEADER_SIZE || available - IPC_HEADER_SIZE < ipcFrameLength(data)) {
+        return 0;
+    }
+    return IPC_HEADER_SIZE + (size_t)ipcFrameLength(data);
+}
+
+#endif /* DISCORD_RPC_IPC_FRAME_H */
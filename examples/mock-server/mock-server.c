@@ -0,0 +1,592 @@
+/*
+    A local stand-in for the Discord client's IPC endpoint.
+
+    Listens on discord-ipc-N in the same directory the library searches, answers the
+    handshake with READY, replies to every command frame, answers pings and can emit
+    ACTIVITY_JOIN, ACTIVITY_JOIN_REQUEST and ERROR events at fixed rates. Lines typed on
+    stdin ping every client or close them with a code, the way Discord does. Useful for
+    exercising the library without a running Discord client.
+
+    Sockets are non-blocking. Whatever a client doesn't read right away waits in its own
+    output buffer, so one slow client never holds up the others.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc_frame.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MAX_CLIENTS 256
+#define MAX_FRAME_SIZE (64 * 1024)
+/* a client that falls this far behind is dropped rather than buffered for */
+#define MAX_OUTPUT_SIZE (4 * 1024 * 1024)
+
+typedef struct Client {
+    int fd;
+    int ready;
+    /* a close frame was queued, the socket is shut once it has been sent */
+    int closing;
+    size_t length;
+    char buffer[MAX_FRAME_SIZE + 1];
+    /* bytes queued for the client, sent from outOffset on */
+    char* out;
+    size_t outLength;
+    size_t outOffset;
+    size_t outCapacity;
+} Client;
+
+typedef struct EventSource {
+    const char* name;
+    double rate;
+    double nextAt;
+    uint64_t sent;
+} EventSource;
+
+static volatile sig_atomic_t Running = 1;
+static int Verbose = 0;
+static Client Clients[MAX_CLIENTS];
+static int ClientCount = 0;
+static uint64_t FramesReceived = 0;
+static uint64_t FramesSent = 0;
+static uint64_t PingsSent = 0;
+static uint64_t PongsReceived = 0;
+static uint64_t ClosesSent = 0;
+
+static EventSource Events[] = {
+    {"ACTIVITY_JOIN", 0, 0, 0},
+    {"ACTIVITY_JOIN_REQUEST", 0, 0, 0},
+    {"ERROR", 0, 0, 0},
+};
+enum { EVENT_JOIN, EVENT_JOIN_REQUEST, EVENT_ERROR, EVENT_COUNT };
+
+static void onSignal(int sig)
+{
+    (void)sig;
+    Running = 0;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static const char* getTempPath()
+{
+    const char* temp = getenv("XDG_RUNTIME_DIR");
+    temp = temp ? temp : getenv("TMPDIR");
+    temp = temp ? temp : getenv("TMP");
+    temp = temp ? temp : getenv("TEMP");
+    temp = temp ? temp : "/tmp";
+    return temp;
+}
+
+static int setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static void dropClient(int index)
+{
+    if (Verbose) {
+        printf("client %d disconnected\n", Clients[index].fd);
+    }
+    close(Clients[index].fd);
+    Clients[index].fd = -1;
+    free(Clients[index].out);
+    Clients[index].out = NULL;
+    Clients[index].outLength = Clients[index].outOffset = Clients[index].outCapacity = 0;
+}
+
+/* sends what the socket takes of the queued bytes, 0 if the client is gone */
+static int flushClient(Client* client)
+{
+    while (client->outOffset < client->outLength) {
+        ssize_t res = send(client->fd, client->out + client->outOffset, client->outLength - client->outOffset,
+                           MSG_NOSIGNAL);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client->outOffset += (size_t)res;
+    }
+    client->outLength = client->outOffset = 0;
+    /* the close frame has left, Discord hangs up at this point */
+    return !client->closing;
+}
+
+/* queues a frame behind whatever the client hasn't taken yet and sends what it can */
+static int sendFrame(Client* client, uint32_t opcode, const char* payload, size_t length)
+{
+    size_t needed;
+
+    if (client->closing) {
+        return 1;
+    }
+    if (client->outOffset) {
+        client->outLength -= client->outOffset;
+        memmove(client->out, client->out + client->outOffset, client->outLength);
+        client->outOffset = 0;
+    }
+    needed = client->outLength + IPC_HEADER_SIZE + length;
+    if (needed > MAX_OUTPUT_SIZE) {
+        return 0;
+    }
+    if (needed > client->outCapacity) {
+        size_t capacity = client->outCapacity ? client->outCapacity : 4096;
+        char* out;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        out = (char*)realloc(client->out, capacity);
+        if (!out) {
+            return 0;
+        }
+        client->out = out;
+        client->outCapacity = capacity;
+    }
+
+    ipcPutHeader(client->out + client->outLength, opcode, (uint32_t)length);
+    memcpy(client->out + client->outLength + IPC_HEADER_SIZE, payload, length);
+    client->outLength += IPC_HEADER_SIZE + length;
+    ++FramesSent;
+    if (opcode == IPC_OP_CLOSE) {
+        client->closing = 1;
+    }
+    return flushClient(client);
+}
+
+/* copies the string value of "key" from a flat json message, empty if absent */
+static void findString(const char* json, const char* key, char* dest, size_t size)
+{
+    char pattern[64];
+    const char* start;
+    const char* end;
+    size_t length;
+
+    dest[0] = 0;
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+    start = strstr(json, pattern);
+    if (!start) {
+        return;
+    }
+    start += strlen(pattern);
+    end = strchr(start, '"');
+    if (!end) {
+        return;
+    }
+    length = (size_t)(end - start);
+    if (length >= size) {
+        length = size - 1;
+    }
+    memcpy(dest, start, length);
+    dest[length] = 0;
+}
+
+static int handleFrame(Client* client, uint32_t opcode, char* payload, size_t length)
+{
+    char message[512];
+    char cmd[64];
+    char nonce[32];
+    char evt[64];
+    int size;
+
+    ++FramesReceived;
+    if (Verbose) {
+        printf("client %d: op %u %.*s\n", client->fd, opcode, (int)length, payload);
+    }
+
+    switch (opcode) {
+    case IPC_OP_HANDSHAKE:
+        size = snprintf(message, sizeof(message),
+                        "{\"cmd\":\"DISPATCH\",\"data\":{\"v\":1,\"config\":{\"cdn_host\":\"cdn.discordapp.com\","
+                        "\"api_endpoint\":\"//discord.com/api\",\"environment\":\"production\"},"
+                        "\"user\":{\"id\":\"100000000000000000\",\"username\":\"mock\","
+                        "\"discriminator\":\"0001\",\"avatar\":null}},\"evt\":\"READY\",\"nonce\":null}");
+        client->ready = 1;
+        return sendFrame(client, IPC_OP_FRAME, message, (size_t)size);
+
+    case IPC_OP_FRAME:
+        if (!client->ready) {
+            return 0;
+        }
+        findString(payload, "cmd", cmd, sizeof(cmd));
+        findString(payload, "nonce", nonce, sizeof(nonce));
+        findString(payload, "evt", evt, sizeof(evt));
+        if (evt[0]) {
+            size = snprintf(message, sizeof(message),
+                            "{\"cmd\":\"%s\",\"data\":{\"evt\":\"%s\"},\"evt\":null,\"nonce\":\"%s\"}",
+                            cmd, evt, nonce);
+        }
+        else {
+            size = snprintf(message, sizeof(message),
+                            "{\"cmd\":\"%s\",\"data\":{},\"evt\":null,\"nonce\":\"%s\"}", cmd, nonce);
+        }
+        return sendFrame(client, IPC_OP_FRAME, message, (size_t)size);
+
+    case IPC_OP_PING:
+        return sendFrame(client, IPC_OP_PONG, payload, length);
+
+    case IPC_OP_PONG:
+        ++PongsReceived;
+        return 1;
+
+    case IPC_OP_CLOSE:
+    default:
+        return 0;
+    }
+}
+
+static int readClient(Client* client)
+{
+    ssize_t res;
+    uint32_t opcode;
+    uint32_t length;
+
+    res = recv(client->fd, client->buffer + client->length, MAX_FRAME_SIZE - client->length, 0);
+    if (res <= 0) {
+        return res < 0 && (errno == EAGAIN || errno == EINTR);
+    }
+    client->length += (size_t)res;
+
+    while (client->length >= IPC_HEADER_SIZE) {
+        opcode = ipcFrameOpcode(client->buffer);
+        length = ipcFrameLength(client->buffer);
+        if (length > MAX_FRAME_SIZE - IPC_HEADER_SIZE) {
+            return 0;
+        }
+        if (!ipcCompleteFrame(client->buffer, client->length)) {
+            break;
+        }
+
+        /* terminate the payload in place, saving the first byte of the next frame */
+        {
+            char* payload = client->buffer + IPC_HEADER_SIZE;
+            char saved = payload[length];
+            payload[length] = 0;
+            if (!handleFrame(client, opcode, payload, length)) {
+                return 0;
+            }
+            payload[length] = saved;
+        }
+
+        client->length -= IPC_HEADER_SIZE + length;
+        memmove(client->buffer, client->buffer + IPC_HEADER_SIZE + length, client->length);
+    }
+    return 1;
+}
+
+static void emitEvent(int type)
+{
+    char message[512];
+    int size;
+    int i;
+    uint64_t n = ++Events[type].sent;
+
+    switch (type) {
+    case EVENT_JOIN:
+        size = snprintf(message, sizeof(message),
+                        "{\"cmd\":\"DISPATCH\",\"data\":{\"secret\":\"join-%llu\"},"
+                        "\"evt\":\"ACTIVITY_JOIN\",\"nonce\":null}",
+                        (unsigned long long)n);
+        break;
+    case EVENT_JOIN_REQUEST:
+        size = snprintf(message, sizeof(message),
+                        "{\"cmd\":\"DISPATCH\",\"data\":{\"user\":{\"id\":\"%llu\",\"username\":\"player%llu\","
+                        "\"discriminator\":\"0001\",\"avatar\":null}},\"evt\":\"ACTIVITY_JOIN_REQUEST\",\"nonce\":null}",
+                        (unsigned long long)(200000000000000000ull + n), (unsigned long long)n);
+        break;
+    default:
+        size = snprintf(message, sizeof(message),
+                        "{\"cmd\":\"DISPATCH\",\"data\":{\"code\":4000,\"message\":\"mock error %llu\"},"
+                        "\"evt\":\"ERROR\",\"nonce\":null}",
+                        (unsigned long long)n);
+        break;
+    }
+
+    for (i = 0; i < ClientCount; ++i) {
+        if (Clients[i].fd != -1 && Clients[i].ready &&
+            !sendFrame(&Clients[i], IPC_OP_FRAME, message, (size_t)size)) {
+            dropClient(i);
+        }
+    }
+}
+
+/* "ping" pings every client, "close [code] [message]" closes them all */
+static void runCommand(char* line)
+{
+    char message[512];
+    char text[256];
+    int code = 1000;
+    int size;
+    int i;
+
+    line[strcspn(line, "\r")] = 0;
+    if (strcmp(line, "ping") == 0) {
+        for (i = 0; i < ClientCount; ++i) {
+            if (Clients[i].fd == -1 || !Clients[i].ready) {
+                continue;
+            }
+            size = snprintf(message, sizeof(message), "{\"nonce\":\"mock-ping-%llu\"}",
+                            (unsigned long long)++PingsSent);
+            if (!sendFrame(&Clients[i], IPC_OP_PING, message, (size_t)size)) {
+                dropClient(i);
+            }
+        }
+    }
+    else if (strncmp(line, "close", 5) == 0 && (line[5] == 0 || line[5] == ' ')) {
+        text[0] = 0;
+        if (sscanf(line + 5, "%d %255[^\n]", &code, text) < 2 && !text[0]) {
+            snprintf(text, sizeof(text), "closed by mock server");
+        }
+        /* keep the payload valid json without escaping */
+        for (i = 0; text[i]; ++i) {
+            if (text[i] == '"' || text[i] == '\\') {
+                text[i] = '\'';
+            }
+        }
+        size = snprintf(message, sizeof(message), "{\"code\":%d,\"message\":\"%s\"}", code, text);
+        for (i = 0; i < ClientCount; ++i) {
+            if (Clients[i].fd == -1) {
+                continue;
+            }
+            ++ClosesSent;
+            if (!sendFrame(&Clients[i], IPC_OP_CLOSE, message, (size_t)size)) {
+                dropClient(i);
+            }
+        }
+    }
+    else if (line[0]) {
+        printf("commands: ping, close [code] [message]\n");
+    }
+}
+
+/* runs every complete line waiting on stdin, 0 once stdin is closed or unreadable */
+static int readCommands()
+{
+    static char pending[512];
+    static size_t length = 0;
+    char* end;
+    ssize_t res = read(STDIN_FILENO, pending + length, sizeof(pending) - 1 - length);
+
+    if (res <= 0) {
+        return res < 0 && (errno == EAGAIN || errno == EINTR);
+    }
+    length += (size_t)res;
+    pending[length] = 0;
+    while ((end = strchr(pending, '\n')) != NULL) {
+        *end = 0;
+        runCommand(pending);
+        length -= (size_t)(end + 1 - pending);
+        memmove(pending, end + 1, length + 1);
+    }
+    /* a line longer than the buffer is thrown away */
+    if (length == sizeof(pending) - 1) {
+        length = 0;
+    }
+    return 1;
+}
+
+static int openListener(int pipeNum, char* path, size_t size)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/discord-ipc-%d", getTempPath(), pipeNum);
+    snprintf(path, size, "%s", addr.sun_path);
+    unlink(addr.sun_path);
+
+    if (!setNonBlocking(fd) || bind(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void usage(const char* name)
+{
+    printf("usage: %s [-n pipe] [-j rate] [-r rate] [-e rate] [-v]\n"
+           "  -n pipe  listen on discord-ipc-<pipe> (default 0)\n"
+           "  -j rate  ACTIVITY_JOIN events per second\n"
+           "  -r rate  ACTIVITY_JOIN_REQUEST events per second\n"
+           "  -e rate  ERROR events per second\n"
+           "  -v       print every received frame\n"
+           "on stdin: ping, close [code] [message]\n",
+           name);
+}
+
+int main(int argc, char* argv[])
+{
+    struct pollfd fds[MAX_CLIENTS + 2];
+    char path[128];
+    int pipeNum = 0;
+    int listener;
+    int commands = 1;
+    int i;
+
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-v") == 0) {
+            Verbose = 1;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            pipeNum = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-j") == 0) {
+            Events[EVENT_JOIN].rate = atof(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-r") == 0) {
+            Events[EVENT_JOIN_REQUEST].rate = atof(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-e") == 0) {
+            Events[EVENT_ERROR].rate = atof(argv[++i]);
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    listener = openListener(pipeNum, path, sizeof(path));
+    if (listener == -1) {
+        perror("listen");
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+    /* run in the background, reading the terminal fails instead of stopping the server */
+    signal(SIGTTIN, SIG_IGN);
+    printf("Listening on %s\n", path);
+
+    for (i = 0; i < EVENT_COUNT; ++i) {
+        Events[i].nextAt = now() + (Events[i].rate > 0 ? 1.0 / Events[i].rate : 0);
+    }
+
+    while (Running) {
+        int timeout = -1;
+        double current = now();
+        int count;
+
+        for (i = 0; i < EVENT_COUNT; ++i) {
+            if (Events[i].rate > 0) {
+                int wait;
+                while (Events[i].nextAt <= current) {
+                    emitEvent(i);
+                    Events[i].nextAt += 1.0 / Events[i].rate;
+                }
+                wait = (int)((Events[i].nextAt - current) * 1000.0) + 1;
+                if (timeout < 0 || wait < timeout) {
+                    timeout = wait;
+                }
+            }
+        }
+
+        /* compact the client list so poll entries map onto it */
+        count = 0;
+        for (i = 0; i < ClientCount; ++i) {
+            if (Clients[i].fd != -1) {
+                if (count != i) {
+                    Clients[count] = Clients[i];
+                }
+                ++count;
+            }
+        }
+        ClientCount = count;
+
+        fds[0].fd = listener;
+        fds[0].events = ClientCount < MAX_CLIENTS ? POLLIN : 0;
+        /* a negative fd is skipped by poll, so stdin drops out once it is closed */
+        fds[1].fd = commands ? STDIN_FILENO : -1;
+        fds[1].events = POLLIN;
+        for (i = 0; i < ClientCount; ++i) {
+            fds[i + 2].fd = Clients[i].fd;
+            fds[i + 2].events = (short)(POLLIN | (Clients[i].outLength ? POLLOUT : 0));
+        }
+
+        if (poll(fds, (nfds_t)ClientCount + 2, timeout) < 0) {
+            continue;
+        }
+
+        for (i = 0; i < ClientCount; ++i) {
+            short revents = fds[i + 2].revents;
+            if (!revents) {
+                continue;
+            }
+            if ((revents & POLLOUT) && !flushClient(&Clients[i])) {
+                dropClient(i);
+            }
+            else if ((revents & ~POLLOUT) && !readClient(&Clients[i])) {
+                dropClient(i);
+            }
+        }
+
+        if (fds[1].revents && !readCommands()) {
+            commands = 0;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd != -1 && !setNonBlocking(fd)) {
+                close(fd);
+            }
+            else if (fd != -1) {
+                Clients[ClientCount].fd = fd;
+                Clients[ClientCount].ready = 0;
+                Clients[ClientCount].closing = 0;
+                Clients[ClientCount].length = 0;
+                Clients[ClientCount].out = NULL;
+                Clients[ClientCount].outLength = Clients[ClientCount].outOffset = Clients[ClientCount].outCapacity = 0;
+                ++ClientCount;
+                if (Verbose) {
+                    printf("client %d connected\n", fd);
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < ClientCount; ++i) {
+        if (Clients[i].fd != -1) {
+            dropClient(i);
+        }
+    }
+    close(listener);
+    unlink(path);
+
+    printf("\nframes received %llu, sent %llu, pings %llu, pongs %llu, closes %llu, "
+           "events join %llu, join request %llu, error %llu\n",
+           (unsigned long long)FramesReceived,
+           (unsigned long long)FramesSent,
+           (unsigned long long)PingsSent,
+           (unsigned long long)PongsReceived,
+           (unsigned long long)ClosesSent,
+           (unsigned long long)Events[EVENT_JOIN].sent,
+           (unsigned long long)Events[EVENT_JOIN_REQUEST].sent,
+           (unsigned long long)Events[EVENT_ERROR].sent);
+    return 0;
+}
@@ -19,6 +19,14 @@ DISCORD_EXPORT void Discord_Respond(const char* userId, enum DiscordReply reply)
 DISCORD_EXPORT void Discord_UpdateConnection(void);
 #endif
 
+DISCORD_EXPORT void Discord_GetStatistics(DiscordStatistics* statistics);
+/* everything but DiscordPresenceFields is fixed until the next template or Discord_UpdatePresence */
+DISCORD_EXPORT void Discord_SetPresenceTemplate(const DiscordRichPresence* presence);
+DISCORD_EXPORT void Discord_UpdatePresenceFields(const DiscordPresenceFields* fields);
+DISCORD_EXPORT void Discord_SetDeferredPresence(int deferred);
+DISCORD_EXPORT void Discord_SetMaxFrameSize(size_t bytes);
+DISCORD_EXPORT void Discord_SetDirectSend(int direct);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -3,6 +3,7 @@
 #include <functional>
 #include "discord_rpc_shared.h"
 
+/* strings past their limit are cut on a UTF-8 character boundary */
 struct CDiscordRichPresence
 {
 	std::string_view state;   /* max 128 bytes */
@@ -63,6 +64,31 @@ struct CDiscordRichPresence
 	}
 };
 
+/* the parts of a presence template that change between updates */
+struct CDiscordPresenceFields
+{
+	std::string_view state;   /* max 128 bytes */
+	std::string_view details; /* max 128 bytes */
+	int64_t startTimestamp{0};
+	int64_t endTimestamp{0};
+	int partySize{0};
+
+	CDiscordPresenceFields()
+	{
+	}
+
+	CDiscordPresenceFields(const DiscordPresenceFields& fields)
+	{
+		if (fields.state)
+			state = fields.state;
+		if (fields.details)
+			details = fields.details;
+		startTimestamp = fields.startTimestamp;
+		endTimestamp = fields.endTimestamp;
+		partySize = fields.partySize;
+	}
+};
+
 struct CDiscordUser
 {
 	std::string_view userId;
@@ -81,6 +107,10 @@ struct CDiscordEventHandlers
 	std::function<void(const CDiscordUser& user)> joinRequest;
 };
 
+/* see DiscordLatency and DiscordStatistics */
+using CDiscordLatency = DiscordLatency;
+using CDiscordStatistics = DiscordStatistics;
+
 class DiscordRpc
 {
 public:
@@ -99,6 +129,19 @@ public:
 #ifdef DISCORD_DISABLE_IO_THREAD
 	virtual void UpdateConnection() = 0;
 #endif
+
+	/* added after the first release, new entries go last to keep the vtable layout */
+	virtual CDiscordStatistics GetStatistics() = 0;
+	/* everything but CDiscordPresenceFields is fixed until the next template or UpdatePresence */
+	virtual void SetPresenceTemplate(const CDiscordRichPresence& presence) = 0;
+	virtual void UpdatePresenceFields(const CDiscordPresenceFields& fields) = 0;
+	/* when enabled, UpdatePresence only copies the presence and the io thread serializes the latest one */
+	virtual void SetDeferredPresence(bool deferred) = 0;
+	/* largest incoming frame kept, 64 KB by default and at least 4 KB; larger ones are skipped */
+	virtual void SetMaxFrameSize(size_t bytes) = 0;
+	/* when enabled, presence updates and replies are written from the calling thread if the connection is idle;
+	   ignored on Windows, where that write would block until the client has read it */
+	virtual void SetDirectSend(bool direct) = 0;
 };
 
 extern "C" DISCORD_EXPORT DiscordRpc* CreateDiscordRpc();
@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
 #if defined(DISCORD_DYNAMIC_LIB)
@@ -39,6 +40,16 @@ extern "C" {
 		int8_t instance;
 	} DiscordRichPresence;
 
+	/* the parts of a presence template that change between updates */
+	typedef struct DiscordPresenceFields
+	{
+		const char* state;   /* max 128 bytes */
+		const char* details; /* max 128 bytes */
+		int64_t startTimestamp;
+		int64_t endTimestamp;
+		int partySize;
+	} DiscordPresenceFields;
+
 	typedef struct DiscordUser
 	{
 		const char* userId;
@@ -57,6 +68,38 @@ extern "C" {
 		void (*joinRequest)(const DiscordUser* request);
 	} DiscordEventHandlers;
 
+	typedef struct DiscordLatency
+	{
+		uint64_t samples;
+		uint64_t p50;  /* microseconds */
+		uint64_t p99;  /* microseconds */
+		uint64_t p999; /* microseconds */
+		uint64_t max;  /* microseconds */
+	} DiscordLatency;
+
+	typedef struct DiscordStatistics
+	{
+		uint64_t ioWakeups; /* times the io thread woke up to pump the connection */
+		uint64_t framesSent; /* outgoing frames, divide by sendCalls for frames per write */
+		uint64_t sendCalls;  /* write calls made to the transport */
+		uint64_t framesReceived; /* incoming frames, divide by receiveCalls for frames per read */
+		uint64_t receiveCalls;   /* read calls made to the transport */
+		uint64_t framesDropped;  /* incoming frames skipped for exceeding the frame size cap */
+		uint64_t sendQueuedBytes; /* bytes waiting for Discord to read, right now */
+		uint64_t sendStalls;      /* times a write couldn't go out whole and had to wait */
+		uint64_t sendStallTime;   /* microseconds spent waiting across finished stalls */
+		uint64_t presenceUpdates;      /* presence changes queued for sending */
+		uint64_t presenceDuplicates;   /* updates skipped because the activity was unchanged */
+		uint64_t presenceBytesSkipped; /* serialized bytes those skipped updates would have sent */
+		uint64_t presenceOverwritten;  /* updates replaced by a newer one before the io thread sent them */
+		uint64_t directSends;          /* frames written from the calling thread, see SetDirectSend */
+		uint64_t commandsDropped;      /* subscriptions and replies lost because the send queue was full or they exceed a frame */
+		uint64_t joinRequestsDropped;  /* join requests lost because RunCallbacks fell behind */
+		/* latencies are only measured when built with ENABLE_LATENCY_STATS, otherwise they stay zero */
+		DiscordLatency presenceLatency; /* UpdatePresence until the write carrying its frame has fully left for the socket */
+		DiscordLatency joinLatency;     /* ACTIVITY_JOIN received until joinGame is called */
+	} DiscordStatistics;
+
 	enum DiscordReply
 	{
 		DISCORD_REPLY_NO = 0,
@@ -45,6 +45,12 @@ struct Backoff
 		return false;
 	}
 
+	int64_t remainingDelay() const
+	{
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(nextAttempt - std::chrono::system_clock::now());
+		return std::max<int64_t>(remaining.count(), 0);
+	}
+
 	void setNewDelay()
 	{
 		nextAttempt = std::chrono::system_clock::now() + std::chrono::milliseconds{ nextDelay() };
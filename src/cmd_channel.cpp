@@ -1,6 +1,24 @@
+#include <cstring>
+#include <iterator>
 #include "cmd_channel.h"
+#include "discord_rpc.hpp"
 #include "rpc_connection.h"
-#include "serialization.h"
+
+// whatever is queued fits in a frame, a command that doesn't is turned away by the ring
+static_assert(SendQueueBytes <= MaxRpcPayloadSize && MaxPresenceCommand <= MaxRpcPayloadSize);
+
+// copies a command serialized on the stack into a record of exactly its size; one that filled a
+// SendQueueBytes scratch may have been cut short, it is too long for the ring and Reserve turns it away
+static bool QueueCommand(RecordQueue<SendQueueBytes>& queue, const char* command, size_t length)
+{
+	char* message = queue.Reserve(length);
+	if (!message)
+		return false;
+
+	memcpy(message, command, length);
+	queue.Commit(message, length);
+	return true;
+}
 
 CmdChannel::CmdChannel(RpcConnection& connection) : connection(connection)
 {
@@ -10,67 +28,241 @@ CmdChannel::CmdChannel(RpcConnection& connection) : connection(connection)
 void CmdChannel::Reset()
 {
 	presenceUpdate.Reset();
+	presenceSnapshot.Reset();
 	presenceBuff.length = 0;
+	presenceBuffHasHead = false;
+	presenceFingerprint = 0;
+
+	sendQueue.Clear();
+}
 
-	while (sendQueue.HavePendingSends())
-		sendQueue.CommitSend();
+void CmdChannel::OnDisconnect()
+{
+	// Discord drops our activity with the connection, the next update must go out even if unchanged
+	presenceFingerprint = 0;
 }
 
 void CmdChannel::SendData()
 {
-	if (presenceUpdate.Consume())
+	std::lock_guard<std::mutex> lock(sendMutex);
+
+	// while Discord isn't reading, leave updates pending so only the latest presence goes out
+	if (!connection.Flush())
+		return;
+	RecordFlushed();
+
+	// everything pending goes out in a single write
+	ConnectionBuffer frames[SendBatchSize + 2];
+	size_t count = 0;
+
+	// the latest values are read in place, they stay ours until the next Consume
+	LatencyClock::time_point presenceTime;
+	bool sendPresence = presenceUpdate.Consume();
+	const Buffer& presence = presenceUpdate.Get(presenceTime);
+
+	// deferred updates are serialized here, once per write instead of once per call
+	LatencyClock::time_point snapshotTime;
+	bool sendSnapshot = presenceSnapshot.Consume();
+	if (sendSnapshot)
+	{
+		PresenceSnapshot& snapshot = presenceSnapshot.Get(snapshotTime);
+		auto view = snapshot.View();
+		int snapshotNonce = nonce++;
+		snapshotBuff.Reserve(MaxPresenceCommand);
+		snapshotBuff.length = JsonWriteRichPresenceObj(snapshotBuff.buffer.get(), snapshotBuff.capacity, snapshotNonce, pid, snapshot.clear ? nullptr : &view);
+		if (IsDuplicate(JsonCommandFingerprint(snapshotBuff.buffer.get(), snapshotBuff.length), snapshotBuff.length, snapshotNonce))
+			sendSnapshot = false;
+		else
+			presenceUpdates.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// both are only pending when the caller switched modes, send them in the order they were made
+	bool snapshotFirst = sendSnapshot && (!sendPresence || !snapshotNewest.load(std::memory_order_relaxed));
+	if (sendSnapshot && snapshotFirst)
+		frames[count++] = {snapshotBuff.buffer.get(), snapshotBuff.length};
+	if (sendPresence)
+		frames[count++] = {presence.buffer.get(), presence.length};
+	if (sendSnapshot && !snapshotFirst)
+		frames[count++] = {snapshotBuff.buffer.get(), snapshotBuff.length};
+
+	// commands are written straight from the queue's ring
+	std::string_view commands[SendBatchSize];
+	size_t queued = sendQueue.Peek(commands, SendBatchSize);
+	for (size_t i = 0; i < queued; ++i)
+		frames[count++] = {commands[i].data(), commands[i].size()};
+
+	if (count == 0)
+		return;
+
+	bool written = connection.Write(frames, count);
+	sendQueue.Release();
+	if (written)
 	{
-		auto local = presenceUpdate.GetBuffer();
-		if (!connection.Write(local.buffer, local.length))
-			presenceUpdate.Set(local);
+		bool queuedTail = connection.HasQueuedWrites();
+		if (sendPresence)
+			RecordWritten(presenceTime, queuedTail);
+		if (sendSnapshot)
+			RecordWritten(snapshotTime, queuedTail);
 	}
+	else if (sendSnapshot && !(sendPresence && snapshotFirst))
+		presenceSnapshot.Restore();
+	else if (sendPresence)
+		presenceUpdate.Restore();
 
-	while (sendQueue.HavePendingSends())
+	// more commands than one batch, the rest follow in their own writes
+	while (written && (queued = sendQueue.Peek(commands, SendBatchSize)) != 0)
 	{
-		auto* qmessage = sendQueue.GetNextSendMessage();
-		connection.Write(qmessage->buffer, qmessage->length);
-		sendQueue.CommitSend();
+		for (size_t i = 0; i < queued; ++i)
+			frames[i] = {commands[i].data(), commands[i].size()};
+		written = connection.Write(frames, queued);
+		sendQueue.Release();
 	}
 }
 
 bool CmdChannel::SubscribeEvent(const char* evtName)
 {
-	auto* qmessage = sendQueue.GetNextAddMessage();
-	if (qmessage)
-	{
-		qmessage->length = JsonWriteSubscribeCommand(qmessage->buffer, sizeof(qmessage->buffer), nonce++, evtName);
-		sendQueue.CommitAdd();
-		return true;
-	}
-	return false;
+	char command[SendQueueBytes];
+	return QueueCommand(sendQueue, command, JsonWriteSubscribeCommand(command, sizeof(command), nonce++, evtName));
 }
 
 bool CmdChannel::UnsubscribeEvent(const char* evtName)
 {
-	auto* qmessage = sendQueue.GetNextAddMessage();
-	if (qmessage)
+	char command[SendQueueBytes];
+	return QueueCommand(sendQueue, command, JsonWriteUnsubscribeCommand(command, sizeof(command), nonce++, evtName));
+}
+
+bool CmdChannel::ReplyJoinRequest(const std::string_view& userId, int reply)
+{
+	char command[SendQueueBytes];
+	size_t length = JsonWriteJoinReply(command, sizeof(command), userId, reply, nonce++);
+	// a reply cut short at the end of the scratch is left to the queue to turn away
+	if (directSend && length < sizeof(command))
 	{
-		qmessage->length = JsonWriteUnsubscribeCommand(qmessage->buffer, sizeof(qmessage->buffer), nonce++, evtName);
-		sendQueue.CommitAdd();
-		return true;
+		bool queued;
+		if (SendDirect(command, length, queued))
+			return queued;
 	}
-	return false;
+
+	return QueueCommand(sendQueue, command, length);
 }
 
-bool CmdChannel::ReplyJoinRequest(const std::string_view& userId, int reply)
+bool CmdChannel::UpdatePresence(const CDiscordRichPresence* presence)
 {
-	auto* qmessage = sendQueue.GetNextAddMessage();
-	if (qmessage)
+	if (deferPresence)
 	{
-		qmessage->length = JsonWriteJoinReply(qmessage->buffer, sizeof(qmessage->buffer), userId, reply, nonce++);
-		sendQueue.CommitAdd();
+		// only copy the values here, the io thread serializes whichever snapshot is latest
+		presenceBuffHasHead = false;
+		snapshotNewest.store(true, std::memory_order_relaxed);
+		presenceSnapshot.Set(PresenceSnapshot(presence));
 		return true;
 	}
-	return false;
+
+	int presenceNonce = nonce++;
+	presenceBuff.Reserve(MaxPresenceCommand);
+	presenceBuff.length = JsonWriteRichPresenceObj(presenceBuff.buffer.get(), presenceBuff.capacity, presenceNonce, pid, presence);
+	presenceBuffHasHead = false;
+	return QueuePresence(JsonCommandFingerprint(presenceBuff.buffer.get(), presenceBuff.length), presenceNonce);
+}
+
+void CmdChannel::SetPresenceTemplate(const CDiscordRichPresence& presence)
+{
+	presenceTemplate.Set(pid, presence);
+	presenceBuffHasHead = false;
 }
 
-void CmdChannel::UpdatePresence(const CDiscordRichPresence* presence)
+bool CmdChannel::UpdatePresenceFields(const CDiscordPresenceFields& fields)
 {
-	presenceBuff.length = JsonWriteRichPresenceObj(presenceBuff.buffer, sizeof(presenceBuff.buffer), nonce++, pid, presence);
+	if (!presenceTemplate.IsSet())
+		return false;
+
+	int presenceNonce = nonce++;
+	// only ever grows before the head is written, so a kept head is never lost
+	presenceBuff.Reserve(MaxPresenceCommand);
+	presenceBuff.length = presenceTemplate.Render(presenceBuff.buffer.get(), presenceBuff.capacity, !presenceBuffHasHead, fields, presenceNonce);
+	presenceBuffHasHead = true;
+
+	// the head hash is known, only the fields behind it are hashed again
+	size_t head = presenceTemplate.HeadLength();
+	uint64_t fingerprint = JsonCommandFingerprint(presenceBuff.buffer.get() + head, presenceBuff.length - head);
+	return QueuePresence(fingerprint ^ presenceTemplate.HeadFingerprint(), presenceNonce);
+}
+
+bool CmdChannel::QueuePresence(uint64_t fingerprint, int presenceNonce)
+{
+	if (IsDuplicate(fingerprint, presenceBuff.length, presenceNonce))
+		return false;
+
+	presenceUpdates.fetch_add(1, std::memory_order_relaxed);
+	if (directSend)
+	{
+		auto start = LatencyStart();
+		bool queued;
+		if (SendDirect(presenceBuff.buffer.get(), presenceBuff.length, queued, &start))
+			return queued;
+	}
+
+	snapshotNewest.store(false, std::memory_order_relaxed);
 	presenceUpdate.Set(presenceBuff);
+	return true;
+}
+
+bool CmdChannel::SendDirect(const char* data, size_t length, bool& queued, const LatencyClock::time_point* presenceTime)
+{
+	// the io thread is sending, or has older frames that must go out first
+	std::unique_lock<std::mutex> lock(sendMutex, std::try_to_lock);
+	if (!lock || presenceUpdate.IsPending() || presenceSnapshot.IsPending() || sendQueue.HavePendingSends())
+		return false;
+
+	if (!connection.WriteDirect(data, length, queued))
+		return false;
+
+	if (presenceTime)
+		RecordWritten(*presenceTime, queued);
+	directSends.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void CmdChannel::RecordWritten(LatencyClock::time_point setTime, bool queued)
+{
+	if constexpr (!LatencyStatsEnabled)
+		return;
+
+	if (!queued)
+		presenceLatency.Record(setTime);
+	else if (unsentCount < std::size(unsentPresence))
+		unsentPresence[unsentCount++] = {setTime, connection.GetCloseCount()};
+}
+
+void CmdChannel::RecordFlushed()
+{
+	if constexpr (!LatencyStatsEnabled)
+		return;
+
+	// frames queued before a reconnect were dropped, not written
+	for (size_t i = 0; i < unsentCount; ++i)
+	{
+		if (unsentPresence[i].closeCount == connection.GetCloseCount())
+			presenceLatency.Record(unsentPresence[i].setTime);
+	}
+	unsentCount = 0;
+}
+
+bool CmdChannel::IsDuplicate(uint64_t fingerprint, size_t length, int presenceNonce)
+{
+	// same activity as last time, skip the hand-off and the write
+	if (presenceFingerprint.exchange(fingerprint) != fingerprint)
+		return false;
+
+	// the fingerprint leaves out the nonce, so the skipped update can give it back
+	ReturnNonce(presenceNonce);
+	presenceDuplicates.fetch_add(1, std::memory_order_relaxed);
+	presenceBytesSkipped.fetch_add(length, std::memory_order_relaxed);
+	return true;
+}
+
+void CmdChannel::ReturnNonce(int unused)
+{
+	// only while no later command has taken one, nonces are never handed out twice
+	int next = unused + 1;
+	nonce.compare_exchange_strong(next, unused);
 }
@@ -1,30 +1,98 @@
 #pragma once
+#include <mutex>
 #include <string_view>
-#include "msg_queue.h"
 #include "presence.h"
+#include "record_queue.h"
+#include "serialization.h"
 
 class RpcConnection;
 struct CDiscordRichPresence;
+struct CDiscordPresenceFields;
+
+// commands are a few hundred bytes at most, they are stored at their serialized size
+constexpr size_t SendQueueBytes = 4 * 1024;
+// queued commands gathered into one write
+constexpr size_t SendBatchSize = 16;
 
 class CmdChannel
 {
 	RpcConnection& connection;
 
 	PresenceEvent presenceUpdate;
-	MsgQueue<Buffer, 8> sendQueue;
+	SnapshotEvent presenceSnapshot;
+	RecordQueue<SendQueueBytes> sendQueue;
 
 	Buffer presenceBuff;
-	int nonce{1};
+	// owned by the io thread, holds the serialized snapshot until it is written
+	Buffer snapshotBuff;
+	std::atomic_int nonce{1};
 	int pid;
+	bool deferPresence{false};
+	bool directSend{false};
+	// held by SendData, a direct write must not slip between frames it is writing
+	std::mutex sendMutex;
+	std::atomic_uint64_t directSends{0};
+
+	PresenceTemplate presenceTemplate;
+	// presenceBuff starts with the template head, only the fields after it need writing
+	bool presenceBuffHasHead{false};
+	// the latest update went through the deferred snapshot, orders the two when the caller switched modes
+	std::atomic_bool snapshotNewest{false};
+
+	// last presence handed to the io thread, 0 if Discord doesn't have one from us
+	std::atomic_uint64_t presenceFingerprint{0};
+	std::atomic_uint64_t presenceUpdates{0};
+	std::atomic_uint64_t presenceDuplicates{0};
+	std::atomic_uint64_t presenceBytesSkipped{0};
+
+	// presence is timed until its frame has left for the socket; frames whose write was partly
+	// queued by the connection wait here for the queue to drain, guarded by sendMutex
+	struct UnsentPresence
+	{
+		LatencyClock::time_point setTime;
+		uint64_t closeCount;
+	};
+	UnsentPresence unsentPresence[2];
+	size_t unsentCount{0};
+	LatencyHistogram presenceLatency;
+
+	bool QueuePresence(uint64_t fingerprint, int presenceNonce);
+	bool IsDuplicate(uint64_t fingerprint, size_t length, int presenceNonce);
+	void ReturnNonce(int unused);
+	bool SendDirect(const char* data, size_t length, bool& queued, const LatencyClock::time_point* presenceTime = nullptr);
+	void RecordWritten(LatencyClock::time_point setTime, bool queued);
+	void RecordFlushed();
 
 public:
 	CmdChannel(RpcConnection& connection);
 
 	void Reset();
+	void OnDisconnect();
 	void SendData();
 
 	bool SubscribeEvent(const char* evtName);
 	bool UnsubscribeEvent(const char* evtName);
+	// these return whether the io thread has something new to send
 	bool ReplyJoinRequest(const std::string_view& userId, int reply);
-	void UpdatePresence(const CDiscordRichPresence* presence);
+	bool UpdatePresence(const CDiscordRichPresence* presence);
+	inline void SetDeferredPresence(bool deferred) { deferPresence = deferred; }
+	// ignored on Windows, where a pipe write blocks until the client has read it
+	inline void SetDirectSend(bool direct)
+	{
+#ifdef _WIN32
+		(void)direct;
+#else
+		directSend = direct;
+#endif
+	}
+	void SetPresenceTemplate(const CDiscordRichPresence& presence);
+	bool UpdatePresenceFields(const CDiscordPresenceFields& fields);
+
+	inline CDiscordLatency GetPresenceLatency() const { return presenceLatency.GetSummary(); }
+	inline uint64_t GetPresenceUpdates() const { return presenceUpdates.load(std::memory_order_relaxed); }
+	inline uint64_t GetPresenceDuplicates() const { return presenceDuplicates.load(std::memory_order_relaxed); }
+	inline uint64_t GetPresenceBytesSkipped() const { return presenceBytesSkipped.load(std::memory_order_relaxed); }
+	inline uint64_t GetCommandsDropped() const { return sendQueue.GetDropped(); }
+	inline uint64_t GetDirectSends() const { return directSends.load(std::memory_order_relaxed); }
+	inline uint64_t GetPresenceOverwritten() const { return presenceUpdate.GetOverwritten() + presenceSnapshot.GetOverwritten(); }
 };
@@ -1,10 +1,13 @@
 #pragma once
+#include <atomic>
 #include <cstdlib>
+#include "transport.h"
 
 // not really connectiony, but need per-platform
 int GetProcessId();
 
-struct BaseConnection
+// unix socket or named pipe to the Discord client
+struct BaseConnection : public Transport
 {
 	union
 	{
@@ -13,12 +16,15 @@ struct BaseConnection
 	};
 
 	BaseConnection();
-	~BaseConnection();
+	~BaseConnection() override;
 
-	bool isOpen{false};
-	bool Open();
-	void Close();
+	std::atomic_bool isOpen{false};
+	bool Open() override;
+	void Close() override;
+	bool IsOpen() const override { return isOpen; }
+	int GetHandle() const override;
 
-	bool Write(const void* data, size_t length);
-	bool Read(void* data, size_t length);
+	using Transport::Write;
+	size_t Write(const ConnectionBuffer* buffers, size_t count) override;
+	size_t Read(void* data, size_t length) override;
 };
@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -79,33 +80,59 @@ void BaseConnection::Close()
     isOpen = false;
 }
 
-bool BaseConnection::Write(const void* data, size_t length)
+int BaseConnection::GetHandle() const
 {
-    if (sock == -1)
-        return false;
+    return sock;
+}
+
+size_t BaseConnection::Write(const ConnectionBuffer* buffers, size_t count)
+{
+    if (sock == -1 || !isOpen || count > MaxConnectionBuffers)
+        return 0;
+
+    iovec iov[MaxConnectionBuffers];
+    for (size_t i = 0; i < count; ++i)
+    {
+        iov[i].iov_base = const_cast<void*>(buffers[i].data);
+        iov[i].iov_len = buffers[i].length;
+    }
+
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
 
-    ssize_t sentBytes = send(sock, data, length, MSG_NOSIGNAL);
+    ssize_t sentBytes = sendmsg(sock, &msg, MSG_NOSIGNAL);
     if (sentBytes < 0)
-        Close();
+    {
+        // socket buffer is full, the caller keeps the rest until it drains
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
 
-    return sentBytes == (ssize_t)length;
+        // writes may come from a caller thread, releasing the socket is left to Close
+        isOpen = false;
+        return 0;
+    }
+
+    return (size_t)sentBytes;
 }
 
-bool BaseConnection::Read(void* data, size_t length)
+size_t BaseConnection::Read(void* data, size_t length)
 {
-    if (sock == -1)
-        return false;
+    if (sock == -1 || !isOpen)
+        return 0;
 
-    int res = (int)recv(sock, data, length, MSG_NOSIGNAL);
+    ssize_t res = recv(sock, data, length, MSG_NOSIGNAL);
     if (res < 0)
     {
-        if (errno == EAGAIN)
-            return false;
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
 
-        Close();
+        // a direct write may be using the socket, releasing it is left to Close
+        isOpen = false;
+        return 0;
     }
     else if (res == 0)
-        Close();
+        isOpen = false;
 
-    return res == (int)length;
+    return (size_t)res;
 }
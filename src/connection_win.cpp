@@ -65,7 +65,13 @@ void BaseConnection::Close()
 	isOpen = false;
 }
 
-bool BaseConnection::Write(const void* data, size_t length)
+int BaseConnection::GetHandle() const
+{
+	// pipe handles can't be waited on by the io thread, it polls instead
+	return -1;
+}
+
+static bool WritePipe(HANDLE pipe, const void* data, size_t length, size_t& written)
 {
 	if (length == 0)
 		return true;
@@ -75,29 +81,50 @@ bool BaseConnection::Write(const void* data, size_t length)
 
 	DWORD bytesLength = (DWORD)length;
 	DWORD bytesWritten = 0;
-	if (WriteFile(pipe, data, bytesLength, &bytesWritten, nullptr))
-		return bytesWritten == bytesLength;
+	bool result = WriteFile(pipe, data, bytesLength, &bytesWritten, nullptr);
+	written += bytesWritten;
+	return result && bytesWritten == bytesLength;
+}
 
-	return false;
+size_t BaseConnection::Write(const ConnectionBuffer* buffers, size_t count)
+{
+	// byte mode pipe, pieces written back to back arrive as one stream
+	// writes block until the client has taken everything, so a short one means the pipe broke
+	// and a direct write from a caller thread waits on the client here
+	size_t written = 0;
+	if (!isOpen)
+		return 0;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!WritePipe(pipe, buffers[i].data, buffers[i].length, written))
+		{
+			// writes may come from a caller thread, releasing the pipe is left to Close
+			isOpen = false;
+			break;
+		}
+	}
+	return written;
 }
 
-bool BaseConnection::Read(void* data, size_t length)
+size_t BaseConnection::Read(void* data, size_t length)
 {
-	if (pipe == INVALID_HANDLE_VALUE || !data)
-		return false;
+	if (pipe == INVALID_HANDLE_VALUE || !isOpen || !data)
+		return 0;
 
 	DWORD bytesAvailable = 0;
 	if (PeekNamedPipe(pipe, nullptr, 0, nullptr, &bytesAvailable, nullptr))
 	{
-		if (bytesAvailable >= length)
+		if (bytesAvailable > 0)
 		{
-			DWORD bytesToRead = (DWORD)length;
+			DWORD bytesToRead = bytesAvailable < length ? bytesAvailable : (DWORD)length;
 			DWORD bytesRead = 0;
 			if (ReadFile(pipe, data, bytesToRead, &bytesRead, nullptr))
-				return bytesToRead == bytesRead;
-			else Close();
+				return bytesRead;
+			// a direct write may be using the pipe, releasing it is left to Close
+			else isOpen = false;
 		}
 	}
-	else Close();
-	return false;
+	else isOpen = false;
+	return 0;
 }
@@ -102,3 +102,36 @@ extern "C" DISCORD_EXPORT void Discord_UpdateHandlers(const DiscordEventHandlers
 {
 	cinstance.UpdateHandlers(WrapHandlers(handlers));
 }
+
+extern "C" DISCORD_EXPORT void Discord_GetStatistics(DiscordStatistics* statistics)
+{
+	if (statistics)
+		*statistics = cinstance.GetStatistics();
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetPresenceTemplate(const DiscordRichPresence* presence)
+{
+	if (presence)
+		cinstance.SetPresenceTemplate(*presence);
+}
+
+extern "C" DISCORD_EXPORT void Discord_UpdatePresenceFields(const DiscordPresenceFields* fields)
+{
+	if (fields)
+		cinstance.UpdatePresenceFields(*fields);
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetDeferredPresence(int deferred)
+{
+	cinstance.SetDeferredPresence(deferred != 0);
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetMaxFrameSize(size_t bytes)
+{
+	cinstance.SetMaxFrameSize(bytes);
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetDirectSend(int direct)
+{
+	cinstance.SetDirectSend(direct != 0);
+}
@@ -28,7 +28,7 @@ void DiscordRpcImpl::Initialize(const std::string_view& applicationId, const CDi
 
 	receiveChannel.SetHandlers(handlers);
 	connection.SetApplicationId(applicationId);
-	thread.Start(std::bind(&DiscordRpcImpl::UpdateConnection, this));
+	thread.Start(std::bind(&DiscordRpcImpl::UpdateConnection, this), std::bind(&DiscordRpcImpl::GetIoWait, this));
 }
 
 void DiscordRpcImpl::Shutdown()
@@ -58,18 +58,42 @@ void DiscordRpcImpl::UpdateHandlers(const CDiscordEventHandlers& handlers)
 
 void DiscordRpcImpl::UpdatePresence(const CDiscordRichPresence& presence)
 {
-	sendChannel.UpdatePresence(&presence);
-	if (isInitialized)
+	if (sendChannel.UpdatePresence(&presence) && isInitialized)
 		thread.Notify();
 }
 
 void DiscordRpcImpl::ClearPresence()
 {
-	sendChannel.UpdatePresence(nullptr);
-	if (isInitialized)
+	if (sendChannel.UpdatePresence(nullptr) && isInitialized)
+		thread.Notify();
+}
+
+void DiscordRpcImpl::SetPresenceTemplate(const CDiscordRichPresence& presence)
+{
+	sendChannel.SetPresenceTemplate(presence);
+}
+
+void DiscordRpcImpl::UpdatePresenceFields(const CDiscordPresenceFields& fields)
+{
+	if (sendChannel.UpdatePresenceFields(fields) && isInitialized)
 		thread.Notify();
 }
 
+void DiscordRpcImpl::SetDeferredPresence(bool deferred)
+{
+	sendChannel.SetDeferredPresence(deferred);
+}
+
+void DiscordRpcImpl::SetDirectSend(bool direct)
+{
+	sendChannel.SetDirectSend(direct);
+}
+
+void DiscordRpcImpl::SetMaxFrameSize(size_t bytes)
+{
+	connection.SetMaxFrameSize(bytes);
+}
+
 void DiscordRpcImpl::Respond(const std::string_view& userId, DiscordReply reply)
 {
 	if (!connection.IsOpen() || userId.empty())
@@ -79,18 +103,69 @@ void DiscordRpcImpl::Respond(const std::string_view& userId, DiscordReply reply)
 		thread.Notify();
 }
 
+CDiscordStatistics DiscordRpcImpl::GetStatistics()
+{
+	CDiscordStatistics stats{};
+	stats.ioWakeups = thread.GetWakeupCount();
+	stats.framesSent = connection.GetFramesWritten();
+	stats.sendCalls = connection.GetWriteCalls();
+	stats.framesReceived = connection.GetFramesRead();
+	stats.receiveCalls = connection.GetReadCalls();
+	stats.framesDropped = connection.GetFramesDropped();
+	stats.sendQueuedBytes = connection.GetQueuedBytes();
+	stats.sendStalls = connection.GetWriteStalls();
+	stats.sendStallTime = connection.GetStallTime();
+	stats.presenceUpdates = sendChannel.GetPresenceUpdates();
+	stats.presenceDuplicates = sendChannel.GetPresenceDuplicates();
+	stats.presenceBytesSkipped = sendChannel.GetPresenceBytesSkipped();
+	stats.presenceOverwritten = sendChannel.GetPresenceOverwritten();
+	stats.directSends = sendChannel.GetDirectSends();
+	stats.commandsDropped = sendChannel.GetCommandsDropped() + connection.GetFramesOversized();
+	stats.joinRequestsDropped = receiveChannel.GetJoinRequestsDropped();
+	stats.presenceLatency = sendChannel.GetPresenceLatency();
+	stats.joinLatency = receiveChannel.GetJoinLatency();
+	return stats;
+}
+
 void DiscordRpcImpl::UpdateConnection()
 {
 	if (!isInitialized)
 		return;
 
-	if (connection.IsOpen())
+	if (!connection.IsOpen())
 	{
-		receiveChannel.ReceiveData();
-		sendChannel.SendData();
+		if (connection.IsConnecting() || backoff.tryConsume())
+			connection.Open();
+		if (!connection.IsOpen())
+			return;
 	}
-	else if (backoff.tryConsume())
-		connection.Open();
+
+	// outgoing updates go first instead of waiting behind the inbound drain,
+	// this also sends the subscriptions queued by a READY handled just now
+	sendChannel.SendData();
+	receiveChannel.ReceiveData();
+}
+
+void DiscordRpcImpl::SetTransport(Transport* transport)
+{
+	if (!isInitialized)
+		connection.SetTransport(transport);
+}
+
+IoWait DiscordRpcImpl::GetIoWait()
+{
+	IoWait wait;
+	if (!isInitialized)
+		return wait;
+
+	wait.handle = connection.GetHandle();
+	wait.writable = connection.HasQueuedWrites();
+	if (!connection.IsOpen() && !connection.IsConnecting())
+		wait.timeout = backoff.remainingDelay();
+	else if (wait.handle == -1)
+		wait.timeout = IoPollInterval;
+
+	return wait;
 }
 
 void DiscordRpcImpl::OnConnect(JsonDocument& readyMessage)
@@ -103,5 +178,6 @@ void DiscordRpcImpl::OnConnect(JsonDocument& readyMessage)
 void DiscordRpcImpl::OnDisconnect(int err, const std::string_view& message)
 {
 	receiveChannel.OnDisconnect(err, message);
+	sendChannel.OnDisconnect();
 	backoff.setNewDelay();
 }
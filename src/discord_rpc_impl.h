@@ -17,6 +17,7 @@ class DiscordRpcImpl : public DiscordRpc
 
 	void OnConnect(JsonDocument& readyMessage);
 	void OnDisconnect(int err, const std::string_view& message);
+	IoWait GetIoWait();
 
 public:
 	DiscordRpcImpl();
@@ -32,5 +33,14 @@ public:
 	void ClearPresence() override;
 	void Respond(const std::string_view& userId, DiscordReply reply) override;
 
+	CDiscordStatistics GetStatistics() override;
+	void SetPresenceTemplate(const CDiscordRichPresence& presence) override;
+	void UpdatePresenceFields(const CDiscordPresenceFields& fields) override;
+	void SetDeferredPresence(bool deferred) override;
+	void SetMaxFrameSize(size_t bytes) override;
+	void SetDirectSend(bool direct) override;
+
 	void UpdateConnection();
+	// swaps the ipc socket/pipe for another transport, call before Initialize
+	void SetTransport(Transport* transport);
 };
@@ -1,12 +1,19 @@
+#include <climits>
 #include "rpc_connection.h"
 #include "cmd_channel.h"
 #include "event_channel.h"
 #include "serialization.h"
 
-EventChannel::EventChannel(RpcConnection& connection, CmdChannel& sendChannel) : connection(connection), sendChannel(sendChannel)
+EventChannel::EventChannel(RpcConnection& connection, CmdChannel& sendChannel)
+  : connection(connection), sendChannel(sendChannel), current(std::make_unique<CDiscordEventHandlers>())
 {
 }
 
+EventChannel::~EventChannel()
+{
+	delete pending.load(std::memory_order_acquire);
+}
+
 static bool DeserializeUser(JsonValue* data, User& connectedUser)
 {
 	auto* user = GetObjMember(data, "user");
@@ -35,6 +42,190 @@ static bool DeserializeUser(JsonValue* data, User& connectedUser)
 	return false;
 }
 
+enum class RpcEvent
+{
+	Unknown,
+	Error,
+	ActivityJoin,
+	ActivitySpectate,
+	ActivityJoinRequest,
+};
+
+// FNV-1a, only used to pick the candidate event name to compare against
+static constexpr uint32_t EventNameHash(std::string_view name)
+{
+	uint32_t hash = 2166136261u;
+	for (char c : name)
+		hash = (hash ^ (uint8_t)c) * 16777619u;
+	return hash;
+}
+
+static RpcEvent FindEvent(std::string_view name)
+{
+	// duplicate case labels don't compile, so the hash stays perfect over the names we handle
+	switch (EventNameHash(name))
+	{
+		case EventNameHash("ERROR"):
+			return name == "ERROR" ? RpcEvent::Error : RpcEvent::Unknown;
+		case EventNameHash("ACTIVITY_JOIN"):
+			return name == "ACTIVITY_JOIN" ? RpcEvent::ActivityJoin : RpcEvent::Unknown;
+		case EventNameHash("ACTIVITY_SPECTATE"):
+			return name == "ACTIVITY_SPECTATE" ? RpcEvent::ActivitySpectate : RpcEvent::Unknown;
+		case EventNameHash("ACTIVITY_JOIN_REQUEST"):
+			return name == "ACTIVITY_JOIN_REQUEST" ? RpcEvent::ActivityJoinRequest : RpcEvent::Unknown;
+		default:
+			return RpcEvent::Unknown;
+	}
+}
+
+// picks the members dispatched events use out of a frame without building a tree
+// strings point into the frame, which is parsed in place
+class EventReader : public JsonReaderHandler<EventReader>
+{
+	enum class Member
+	{
+		None,
+		Evt,
+		Data,
+		Secret,
+		Code,
+		Message,
+		User,
+		UserId,
+		Username,
+		Discriminator,
+		Avatar,
+	};
+
+	static constexpr int MaxDepth = 4;
+
+	int depth{0};
+	Member key{Member::None};
+	// key each open object was stored under
+	Member objects[MaxDepth]{};
+
+	inline bool InData() const { return depth == 2 && objects[1] == Member::Data; }
+	inline bool InUser() const { return depth == 3 && objects[1] == Member::Data && objects[2] == Member::User; }
+
+public:
+	RpcEvent event{RpcEvent::Unknown};
+	bool hasData{false};
+	bool hasUser{false};
+	int code{0};
+	// unset members have no data, present but empty ones do
+	std::string_view secret;
+	std::string_view message;
+	std::string_view userId;
+	std::string_view username;
+	std::string_view discriminator;
+	std::string_view avatar;
+
+	bool Default()
+	{
+		key = Member::None;
+		return true;
+	}
+
+	bool Null()
+	{
+		// no event to dispatch, stop reading
+		if (key == Member::Evt)
+			return false;
+		return Default();
+	}
+
+	bool Int(int value)
+	{
+		if (key == Member::Code)
+			code = value;
+		return Default();
+	}
+
+	bool Uint(unsigned value)
+	{
+		if (key == Member::Code && value <= INT_MAX)
+			code = (int)value;
+		return Default();
+	}
+
+	bool String(const char* str, rapidjson::SizeType length, bool)
+	{
+		std::string_view value{str, length};
+		switch (key)
+		{
+			case Member::Evt:
+				event = FindEvent(value);
+				// nothing we dispatch, the rest of the frame doesn't matter
+				if (event == RpcEvent::Unknown)
+					return false;
+				break;
+			case Member::Secret: secret = value; break;
+			case Member::Message: message = value; break;
+			case Member::UserId: userId = value; break;
+			case Member::Username: username = value; break;
+			case Member::Discriminator: discriminator = value; break;
+			case Member::Avatar: avatar = value; break;
+			default: break;
+		}
+		return Default();
+	}
+
+	bool Key(const char* str, rapidjson::SizeType length, bool)
+	{
+		std::string_view name{str, length};
+		key = Member::None;
+		if (depth == 1)
+		{
+			if (name == "evt")
+				key = Member::Evt;
+			else if (name == "data")
+				key = Member::Data;
+		}
+		else if (InData())
+		{
+			if (name == "secret")
+				key = Member::Secret;
+			else if (name == "code")
+				key = Member::Code;
+			else if (name == "message")
+				key = Member::Message;
+			else if (name == "user")
+				key = Member::User;
+		}
+		else if (InUser())
+		{
+			if (name == "id")
+				key = Member::UserId;
+			else if (name == "username")
+				key = Member::Username;
+			else if (name == "discriminator")
+				key = Member::Discriminator;
+			else if (name == "avatar")
+				key = Member::Avatar;
+		}
+		return true;
+	}
+
+	bool StartObject()
+	{
+		if (depth == 1 && key == Member::Data)
+			hasData = true;
+		else if (InData() && key == Member::User)
+			hasUser = true;
+
+		if (depth < MaxDepth)
+			objects[depth] = key;
+		++depth;
+		return Default();
+	}
+
+	bool EndObject(rapidjson::SizeType)
+	{
+		--depth;
+		return Default();
+	}
+};
+
 static void DeserializeUser(JsonDocument& message, User& connectedUser)
 {
 	auto data = GetObjMember(&message, "data");
@@ -59,95 +250,148 @@ void EventChannel::OnDisconnect(int err, const std::string_view& message)
 
 void EventChannel::ReceiveData()
 {
+	JsonReader reader;
 	for (;;)
 	{
-		JsonDocument message;
-		if (!connection.Read(message))
+		char* message;
+		size_t length;
+		if (!connection.Read(message, length))
 			break;
 
-		auto* evtName = GetStrMember(&message, "evt");
-		auto* data = GetObjMember(&message, "data");
-
-		if (!evtName || !data)
+		EventReader fields;
+		rapidjson::InsituStringStream stream(message);
+		if (!reader.Parse<rapidjson::kParseInsituFlag>(stream, fields) || !fields.hasData)
 			continue;
-		std::string_view eventName = evtName;
 
-		if (eventName == "ERROR")
-			onError.Set(GetIntMember(data, "code"), GetStrMember(data, "message", ""));
-		else if (eventName == "ACTIVITY_JOIN")
-		{
-			auto* secret = GetStrMember(data, "secret");
-			if (secret)
-				onJoinGame.Set(secret);
-		}
-		else if (eventName == "ACTIVITY_SPECTATE")
+		switch (fields.event)
 		{
-			auto* secret = GetStrMember(data, "secret");
-			if (secret)
-				onSpectateGame.Set(secret);
-		}
-		else if (eventName == "ACTIVITY_JOIN_REQUEST")
-		{
-			auto* joinReq = joinAskQueue.GetNextAddMessage();
-			if (joinReq && DeserializeUser(data, *joinReq))
-				joinAskQueue.CommitAdd();
+			case RpcEvent::Error:
+				onError.Set(fields.code, fields.message);
+				break;
+
+			case RpcEvent::ActivityJoin:
+				if (fields.secret.data())
+					onJoinGame.Set(fields.secret);
+				break;
+
+			case RpcEvent::ActivitySpectate:
+				if (fields.secret.data())
+					onSpectateGame.Set(fields.secret);
+				break;
+
+			case RpcEvent::ActivityJoinRequest:
+			{
+				if (!fields.hasUser || !fields.userId.data() || !fields.username.data())
+					break;
+
+				auto* joinReq = joinAskQueue.GetNextAddMessage();
+				if (joinReq)
+				{
+					joinReq->userId = fields.userId;
+					joinReq->username = fields.username;
+					joinReq->discriminator = fields.discriminator;
+					joinReq->avatar = fields.avatar;
+					joinAskQueue.CommitAdd(joinReq);
+				}
+				break;
+			}
+
+			default:
+				break;
 		}
 	}
 }
 
-void EventChannel::SetHandlers(const CDiscordEventHandlers& newHandlers)
+// events that are only subscribed to while their handler is set
+struct Subscription
 {
-	// used in Discord_Initialize
-	std::lock_guard<std::mutex> guard(mutex);
-	handlers = newHandlers;
-}
+	uint32_t bit;
+	const char* event;
+};
 
-void EventChannel::InitHandlers()
+static constexpr Subscription Subscriptions[]{
+	{1, "ACTIVITY_JOIN"},
+	{2, "ACTIVITY_SPECTATE"},
+	{4, "ACTIVITY_JOIN_REQUEST"},
+};
+
+static uint32_t SubscriptionMask(const CDiscordEventHandlers& handlers)
 {
-	// used in onConnect event
-	std::lock_guard<std::mutex> guard(mutex);
+	uint32_t mask = 0;
 	if (handlers.joinGame)
-		sendChannel.SubscribeEvent("ACTIVITY_JOIN");
+		mask |= Subscriptions[0].bit;
 	if (handlers.spectateGame)
-		sendChannel.SubscribeEvent("ACTIVITY_SPECTATE");
+		mask |= Subscriptions[1].bit;
 	if (handlers.joinRequest)
-		sendChannel.SubscribeEvent("ACTIVITY_JOIN_REQUEST");
+		mask |= Subscriptions[2].bit;
+	return mask;
 }
 
-void EventChannel::UpdateHandlers(const CDiscordEventHandlers& newHandlers)
+void EventChannel::PublishHandlers(const CDiscordEventHandlers& newHandlers)
+{
+	// a table RunCallbacks hasn't taken is no one else's, the one it calls through isn't touched
+	delete pending.exchange(new CDiscordEventHandlers(newHandlers), std::memory_order_acq_rel);
+}
+
+void EventChannel::SetHandlers(const CDiscordEventHandlers& newHandlers)
 {
-	if (!connection.IsOpen())
+	// used in Discord_Initialize
 	{
-		SetHandlers(newHandlers);
-		return;
+		std::lock_guard<std::mutex> guard(subscriptionMutex);
+		subscriptions = SubscriptionMask(newHandlers);
+	}
+	PublishHandlers(newHandlers);
+}
+
+void EventChannel::InitHandlers()
+{
+	// used in onConnect event, only the mask is read so user code can't hold up the io thread
+	std::lock_guard<std::mutex> guard(subscriptionMutex);
+	uint32_t mask = subscriptions;
+	for (auto& subscription : Subscriptions)
+	{
+		if (mask & subscription.bit)
+			sendChannel.SubscribeEvent(subscription.event);
 	}
+}
 
-	// mutex prevents bugs related to un/subscribed events
-	std::lock_guard<std::mutex> guard(mutex);
+void EventChannel::UpdateHandlers(const CDiscordEventHandlers& newHandlers)
+{
+	{
+		// mutex prevents bugs related to un/subscribed events
+		std::lock_guard<std::mutex> guard(subscriptionMutex);
+		uint32_t mask = SubscriptionMask(newHandlers);
+		uint32_t previous = subscriptions.exchange(mask);
 
-	// register for events if not registered and handler was added
+		// register for events if not registered and handler was added
 		// deregister for events if registered and handler was removed
-	if (!handlers.joinGame && newHandlers.joinGame)
-		sendChannel.SubscribeEvent("ACTIVITY_JOIN");
-	else if (handlers.joinGame && !newHandlers.joinGame)
-		sendChannel.UnsubscribeEvent("ACTIVITY_JOIN");
-
-	if (!handlers.spectateGame && newHandlers.spectateGame)
-		sendChannel.SubscribeEvent("ACTIVITY_SPECTATE");
-	else if (handlers.spectateGame && !newHandlers.spectateGame)
-		sendChannel.UnsubscribeEvent("ACTIVITY_SPECTATE");
-
-	if (!handlers.joinRequest && newHandlers.joinRequest)
-		sendChannel.SubscribeEvent("ACTIVITY_JOIN_REQUEST");
-	else if (handlers.joinRequest && !newHandlers.joinRequest)
-		sendChannel.UnsubscribeEvent("ACTIVITY_JOIN_REQUEST");
-
-	handlers = newHandlers;
+		// while disconnected, InitHandlers subscribes on the next connect
+		if (connection.IsOpen())
+		{
+			for (auto& subscription : Subscriptions)
+			{
+				if ((mask & ~previous) & subscription.bit)
+					sendChannel.SubscribeEvent(subscription.event);
+				else if ((previous & ~mask) & subscription.bit)
+					sendChannel.UnsubscribeEvent(subscription.event);
+			}
+		}
+	}
+	PublishHandlers(newHandlers);
 }
 
 void EventChannel::RunCallbacks()
 {
-	std::lock_guard<std::mutex> guard(mutex);
+	// new handlers take effect from here; one set by a callback below waits for the next call
+	if (pending.load(std::memory_order_relaxed))
+		current.reset(pending.exchange(nullptr, std::memory_order_acquire));
+
+	// most frames have nothing to deliver, which shouldn't cost more than a look at each slot
+	if (!onDisconnect.IsPending() && !onConnect.IsPending() && !onError.IsPending() &&
+		!onJoinGame.IsPending() && !onSpectateGame.IsPending() && !joinAskQueue.HavePendingSends())
+		return;
+
+	auto& handlers = *current;
 
 	// we want the sequence to seem sane, so any other signals
 	// are book-ended by calls to ready and disconnect.
@@ -184,7 +428,10 @@ void EventChannel::RunCallbacks()
 
 	if (onJoinGame.Consume() && handlers.joinGame)
 	{
-		handlers.joinGame(onJoinGame.GetSecret());
+		LatencyClock::time_point setTime;
+		auto secret = onJoinGame.GetSecret(setTime);
+		joinLatency.Record(setTime);
+		handlers.joinGame(secret);
 	}
 
 	if (onSpectateGame.Consume() && handlers.spectateGame)
@@ -1,4 +1,7 @@
 #pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include "discord_rpc.hpp"
 #include "msg_queue.h"
 #include "events.h"
@@ -11,8 +14,15 @@ class EventChannel
 {
 	RpcConnection& connection;
 	CmdChannel& sendChannel;
-	std::mutex mutex;
-	CDiscordEventHandlers handlers;
+
+	// UpdateHandlers publishes a new table here, replacing one RunCallbacks hasn't taken yet
+	std::atomic<CDiscordEventHandlers*> pending{nullptr};
+	// the table callbacks go through, only touched by the thread running RunCallbacks
+	std::unique_ptr<CDiscordEventHandlers> current;
+	// events subscribed for the current handlers, all the io thread needs to know of them
+	std::atomic_uint32_t subscriptions{0};
+	// keeps subscription changes from interleaving; never held while user code runs
+	std::mutex subscriptionMutex;
 
 	ConnectEvent onConnect;
 	DisconnectEvent onDisconnect;
@@ -21,8 +31,13 @@ class EventChannel
 	SpectateGameEvent onSpectateGame;
 	MsgQueue<User, 8> joinAskQueue;
 
+	LatencyHistogram joinLatency;
+
+	void PublishHandlers(const CDiscordEventHandlers& newHandlers);
+
 public:
 	EventChannel(RpcConnection& connection, CmdChannel& sendChannel);
+	~EventChannel();
 
 	void OnConnect(JsonDocument& readyMessage);
 	void OnDisconnect(int err, const std::string_view& message);
@@ -33,4 +48,7 @@ public:
 	void UpdateHandlers(const CDiscordEventHandlers& newHandlers);
 
 	void RunCallbacks();
+
+	inline CDiscordLatency GetJoinLatency() const { return joinLatency.GetSummary(); }
+	inline uint64_t GetJoinRequestsDropped() const { return joinAskQueue.GetDropped(); }
 };
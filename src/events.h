@@ -1,7 +1,11 @@
 #pragma once
 #include <atomic>
-#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
 #include "fixed_string.h"
+#include "latency_histogram.h"
 
 struct User
 {
@@ -15,58 +19,128 @@ struct User
 	FixedString<35> avatar;
 };
 
+// single writer slot read without locks: the writer makes the sequence odd while it copies in,
+// a reader copies out and retries if the sequence moved meanwhile
+// the slot is shared as words accessed through relaxed atomics, so a torn read is thrown away instead of racing;
+// values are memcpy'd to and from those words, never aliased
+template <typename Data>
+class SeqlockSlot
+{
+	static_assert(std::is_trivially_copyable_v<Data>, "SeqlockSlot copies its data as raw bytes");
+	static constexpr size_t Words = (sizeof(Data) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	std::atomic_uint32_t sequence{0};
+	mutable uint64_t words[Words]{};
+
+public:
+	SeqlockSlot()
+	{
+		Write(Data{});
+	}
+
+	inline void Write(const Data& data)
+	{
+		uint64_t source[Words]{};
+		memcpy(source, &data, sizeof(Data));
+
+		uint32_t current = sequence.load(std::memory_order_relaxed);
+		sequence.store(current + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		for (size_t i = 0; i < Words; ++i)
+			std::atomic_ref<uint64_t>(words[i]).store(source[i], std::memory_order_relaxed);
+
+		sequence.store(current + 2, std::memory_order_release);
+	}
+
+	inline Data Read() const
+	{
+		uint64_t copy[Words];
+		for (;;)
+		{
+			uint32_t before = sequence.load(std::memory_order_acquire);
+			if (before & 1)
+				continue;
+
+			for (size_t i = 0; i < Words; ++i)
+				copy[i] = std::atomic_ref<uint64_t>(words[i]).load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence.load(std::memory_order_relaxed) == before)
+				break;
+		}
+
+		Data data;
+		memcpy(&data, copy, sizeof(Data));
+		return data;
+	}
+};
+
+// the io thread sets, RunCallbacks consumes; checking for nothing pending is a single relaxed load
 class ConnectEvent
 {
 	std::atomic_bool awaiting{false};
-	std::mutex mutex;
-	User user{};
+	SeqlockSlot<User> user;
 
 public:
 	inline void Set(const User& user)
 	{
-		std::lock_guard lock(mutex);
-		this->user = user;
-		awaiting = true;
+		this->user.Write(user);
+		awaiting.store(true, std::memory_order_release);
+	}
+
+	inline bool IsPending() const
+	{
+		return awaiting.load(std::memory_order_relaxed);
 	}
 
 	inline bool Consume()
 	{
-		return awaiting.exchange(false);
+		return awaiting.load(std::memory_order_relaxed) && awaiting.exchange(false, std::memory_order_acquire);
 	}
 
 	inline User GetUser()
 	{
-		std::lock_guard lock(mutex);
-		return user;
+		return user.Read();
 	}
 };
 
 class DisconnectEvent
 {
+	struct Args
+	{
+		int code{0};
+		FixedString<256> message;
+	};
+
 	std::atomic_bool awaiting{false};
-	std::mutex mutex;
-	int code{0};
-	FixedString<256> message;
+	SeqlockSlot<Args> args;
 
 public:
 	inline void Set(int code, const std::string_view& message)
 	{
-		std::lock_guard lock(mutex);
-		this->code = code;
-		this->message = message;
+		Args latest;
+		latest.code = code;
+		latest.message = message;
+		args.Write(latest);
+
+		awaiting.store(true, std::memory_order_release);
+	}
 
-		awaiting = true;
+	inline bool IsPending() const
+	{
+		return awaiting.load(std::memory_order_relaxed);
 	}
 
 	inline bool Consume()
 	{
-		return awaiting.exchange(false);
+		return awaiting.load(std::memory_order_relaxed) && awaiting.exchange(false, std::memory_order_acquire);
 	}
 
 	inline std::pair<int, FixedString<256>> GetArgs()
 	{
-		std::lock_guard lock(mutex);
-		return std::make_pair(code, message);
+		Args latest = args.Read();
+		return std::make_pair(latest.code, latest.message);
 	}
 };
 
@@ -74,27 +148,45 @@ typedef DisconnectEvent ErrorEvent;
 
 class JoinGameEvent
 {
+	struct Args
+	{
+		FixedString<256> secret;
+		LatencyClock::time_point setTime;
+	};
+
 	std::atomic_bool awaiting{false};
-	std::mutex mutex;
-	FixedString<256> secret;
+	SeqlockSlot<Args> args;
 
 public:
-	inline void Set(const char* secret)
+	inline void Set(const std::string_view& secret)
+	{
+		Args latest;
+		latest.secret = secret;
+		latest.setTime = LatencyStart();
+		args.Write(latest);
+		awaiting.store(true, std::memory_order_release);
+	}
+
+	inline bool IsPending() const
 	{
-		std::lock_guard lock(mutex);
-		this->secret = secret;
-		awaiting = true;
+		return awaiting.load(std::memory_order_relaxed);
 	}
 
 	inline bool Consume()
 	{
-		return awaiting.exchange(false);
+		return awaiting.load(std::memory_order_relaxed) && awaiting.exchange(false, std::memory_order_acquire);
 	}
 
 	inline FixedString<256> GetSecret()
 	{
-		std::lock_guard lock(mutex);
-		return secret;
+		return args.Read().secret;
+	}
+
+	inline FixedString<256> GetSecret(LatencyClock::time_point& setTime)
+	{
+		Args latest = args.Read();
+		setTime = latest.setTime;
+		return latest.secret;
 	}
 };
 
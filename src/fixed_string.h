@@ -1,7 +1,21 @@
 #pragma once
+#include <cstring>
 #include <string_view>
 #include <stdexcept>
 
+// longest prefix of text that fits maxLength bytes without splitting a UTF-8 sequence
+inline std::string_view Utf8Prefix(const std::string_view& text, size_t maxLength)
+{
+	if (text.size() <= maxLength)
+		return text;
+
+	// back up over continuation bytes to the start of the sequence that doesn't fit
+	size_t length = maxLength;
+	while (length > 0 && ((unsigned char)text[length] & 0xC0) == 0x80)
+		--length;
+	return text.substr(0, length);
+}
+
 template <size_t Size>
 class FixedString
 {
@@ -15,48 +29,21 @@ public:
 	FixedString() : size(0), buffer{}
 	{}
 
-	FixedString(const FixedString& other)
-	{
-		size = other.size;
-		memcpy(buffer, other.buffer, size + 1);
-	}
-
-	FixedString(FixedString&& other)
-	{
-		size = other.size;
-		memcpy(buffer, other.buffer, size + 1);
-		other.size = 0;
-	}
-
-	FixedString& operator=(const FixedString& other)
-	{
-		size = other.size;
-		memcpy(buffer, other.buffer, size + 1);
-		return *this;
-	}
-
-	FixedString& operator=(FixedString&& other)
-	{
-		size = other.size;
-		memcpy(buffer, other.buffer, size + 1);
-		other.size = 0;
-		return *this;
-	}
+	// trivially copyable, so it can be copied as raw words between threads
+	FixedString(const FixedString& other) = default;
+	FixedString& operator=(const FixedString& other) = default;
 
+	// longer strings are cut on a character boundary
 	FixedString(const std::string_view& other)
 	{
-		size = other.size();
-		if (size >= Size)
-			size = Size - 1;
+		size = Utf8Prefix(other, Size - 1).size();
 		memcpy(buffer, other.data(), size);
 		buffer[size] = 0;
 	}
 
 	FixedString& operator=(const std::string_view& other)
 	{
-		size = other.size();
-		if (size >= Size)
-			size = Size - 1;
+		size = Utf8Prefix(other, Size - 1).size();
 		memcpy(buffer, other.data(), size);
 		buffer[size] = 0;
 		return *this;
@@ -1,46 +1,432 @@
 #include "io_thread.h"
 
 #ifndef DISCORD_DISABLE_IO_THREAD
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+	#include <climits>
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+#elif !defined(_WIN32)
+	#include <climits>
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <unistd.h>
+#endif
+
+// pumps every registered instance from one thread, sleeping until one of them has work
+class IoReactor
+{
+	std::mutex lifecycleMutex;
+	// held while pumping, so a source is never removed mid-update
+	std::mutex sourcesMutex;
+	std::vector<IoThread*> sources;
+	std::jthread thread;
+
+#ifdef __linux__
+	int epollFd{-1};
+	std::atomic_int eventFd{-1};
+#elif !defined(_WIN32)
+	// self pipe, written to wake the poll
+	std::atomic_int wakeRead{-1};
+	std::atomic_int wakeWrite{-1};
+#endif
+	// used when sockets can't be waited on: on Windows, or if the wait handles couldn't be created
+	bool waitOnHandles{false};
+	std::mutex waitMutex;
+	std::condition_variable activity;
+	bool woken{false};
+
+	void Run(std::stop_token token);
+	int64_t PumpSources();
+	bool OpenWaitHandles();
+	void CloseWaitHandles();
+	void Watch(IoThread* source, const IoWait& wait);
+	void Wait(int64_t timeout);
+	void WaitHandles(int64_t timeout);
+	void WaitSignal(int64_t timeout);
+
+public:
+	static IoReactor& Get()
+	{
+		// never destroyed, instances with static storage may unregister during exit
+		static IoReactor* reactor = new IoReactor();
+		return *reactor;
+	}
+
+	void Add(IoThread* source);
+	void Remove(IoThread* source);
+	void Wake();
+};
+
+void IoReactor::Add(IoThread* source)
+{
+	std::lock_guard<std::mutex> lifecycle(lifecycleMutex);
+	{
+		std::lock_guard<std::mutex> lock(sourcesMutex);
+		sources.push_back(source);
+	}
+	source->notified = true;
+
+	if (!thread.joinable())
+	{
+		// without them sockets are polled every IoPollInterval instead
+		waitOnHandles = OpenWaitHandles();
+		thread = std::jthread([this](std::stop_token token) { Run(token); });
+	}
+
+	Wake();
+}
+
+void IoReactor::Remove(IoThread* source)
+{
+	std::lock_guard<std::mutex> lifecycle(lifecycleMutex);
+	bool empty;
+	{
+		std::lock_guard<std::mutex> lock(sourcesMutex);
+		sources.erase(std::remove(sources.begin(), sources.end(), source), sources.end());
+		Watch(source, IoWait{});
+		source->hasDeadline = false;
+		empty = sources.empty();
+	}
+
+	if (!empty || !thread.joinable())
+		return;
+
+	thread.request_stop();
+	Wake();
+	thread.join();
+
+	CloseWaitHandles();
+	waitOnHandles = false;
+}
+
+void IoReactor::Run(std::stop_token token)
+{
+	while (!token.stop_requested())
+		Wait(PumpSources());
+}
+
+int64_t IoReactor::PumpSources()
+{
+	std::lock_guard<std::mutex> lock(sourcesMutex);
+
+	auto now = std::chrono::steady_clock::now();
+	int64_t timeout = -1;
+	for (auto* source : sources)
+	{
+		bool expired = source->hasDeadline && now >= source->deadline;
+		bool notified = source->notified.exchange(false);
+		if (notified || source->ready || expired)
+		{
+			source->ready = false;
+			++source->wakeups;
+			source->callback();
+
+			auto wait = source->waitHint();
+			// sockets can't be waited on, poll them
+			if (!waitOnHandles && wait.handle != -1 && (wait.timeout < 0 || wait.timeout > IoPollInterval))
+				wait.timeout = IoPollInterval;
+			Watch(source, wait);
+
+			now = std::chrono::steady_clock::now();
+			source->hasDeadline = wait.timeout >= 0;
+			source->deadline = now + std::chrono::milliseconds{wait.timeout};
+		}
+
+		if (source->hasDeadline)
+		{
+			auto remaining = std::chrono::ceil<std::chrono::milliseconds>(source->deadline - now).count();
+			remaining = std::max<int64_t>(remaining, 0);
+			if (timeout < 0 || remaining < timeout)
+				timeout = remaining;
+		}
+	}
+	return timeout;
+}
+
+void IoReactor::Wait(int64_t timeout)
+{
+	if (waitOnHandles)
+		WaitHandles(timeout);
+	else
+		WaitSignal(timeout);
+}
+
+void IoReactor::WaitSignal(int64_t timeout)
+{
+	std::unique_lock<std::mutex> lock(waitMutex);
+	if (timeout < 0)
+		activity.wait(lock, [this]() { return woken; });
+	else
+		activity.wait_for(lock, std::chrono::milliseconds{timeout}, [this]() { return woken; });
+
+	woken = false;
+}
+
+#ifdef __linux__
+bool IoReactor::OpenWaitHandles()
+{
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	epoll_event event{};
+	event.events = EPOLLIN;
+	event.data.ptr = nullptr;
+	if (epollFd != -1 && eventFd != -1 && epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &event) == 0)
+		return true;
+
+	CloseWaitHandles();
+	return false;
+}
+
+void IoReactor::CloseWaitHandles()
+{
+	int fd = eventFd.exchange(-1);
+	if (fd != -1)
+		close(fd);
+	if (epollFd != -1)
+		close(epollFd);
+	epollFd = -1;
+}
+
+void IoReactor::Watch(IoThread* source, const IoWait& wait)
+{
+	bool writable = wait.handle != -1 && wait.writable;
+	if (wait.handle == source->watchedFd && writable == source->watchedWrite)
+		return;
+
+	if (waitOnHandles)
+	{
+		epoll_event event{};
+		event.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+		event.data.ptr = source;
+
+		if (wait.handle == source->watchedFd)
+			epoll_ctl(epollFd, EPOLL_CTL_MOD, wait.handle, &event);
+		else
+		{
+			// a closed socket has already left the set; this runs right after the update that
+			// closed it, so no other source can have been handed the same descriptor yet
+			if (source->watchedFd != -1)
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, source->watchedFd, nullptr);
+
+			if (wait.handle != -1)
+				epoll_ctl(epollFd, EPOLL_CTL_ADD, wait.handle, &event);
+		}
+	}
+
+	source->watchedFd = wait.handle;
+	source->watchedWrite = writable;
+}
+
+void IoReactor::WaitHandles(int64_t timeout)
+{
+	epoll_event events[64];
+	int count = epoll_wait(epollFd, events, 64, timeout < INT_MAX ? (int)timeout : INT_MAX);
+
+	std::lock_guard<std::mutex> lock(sourcesMutex);
+	for (int i = 0; i < count; ++i)
+	{
+		auto* source = (IoThread*)events[i].data.ptr;
+		if (!source)
+		{
+			uint64_t value;
+			(void)!read(eventFd, &value, sizeof(value));
+			continue;
+		}
+
+		// may have been removed while we were asleep
+		if (std::find(sources.begin(), sources.end(), source) != sources.end())
+			source->ready = true;
+	}
+}
+
+void IoReactor::Wake()
+{
+	int fd = eventFd;
+	if (fd != -1)
+	{
+		uint64_t value = 1;
+		(void)!write(fd, &value, sizeof(value));
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(waitMutex);
+		woken = true;
+	}
+	activity.notify_one();
+}
+#elif !defined(_WIN32)
+bool IoReactor::OpenWaitHandles()
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+
+	for (int fd : fds)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	wakeRead = fds[0];
+	wakeWrite = fds[1];
+	return true;
+}
+
+void IoReactor::CloseWaitHandles()
+{
+	int fd = wakeWrite.exchange(-1);
+	if (fd != -1)
+		close(fd);
+	fd = wakeRead.exchange(-1);
+	if (fd != -1)
+		close(fd);
+}
+
+void IoReactor::Watch(IoThread* source, const IoWait& wait)
+{
+	source->watchedFd = wait.handle;
+	source->watchedWrite = wait.handle != -1 && wait.writable;
+}
+
+void IoReactor::WaitHandles(int64_t timeout)
+{
+	// the poll set is rebuilt for every wait, there are only ever a handful of instances
+	std::vector<pollfd> fds;
+	std::vector<IoThread*> watched;
+	{
+		std::lock_guard<std::mutex> lock(sourcesMutex);
+		fds.push_back({wakeRead, POLLIN, 0});
+		for (auto* source : sources)
+		{
+			if (source->watchedFd == -1)
+				continue;
+
+			fds.push_back({source->watchedFd, (short)(source->watchedWrite ? POLLIN | POLLOUT : POLLIN), 0});
+			watched.push_back(source);
+		}
+	}
+
+	int count = poll(fds.data(), (nfds_t)fds.size(), timeout < INT_MAX ? (int)timeout : INT_MAX);
+	if (count <= 0)
+		return;
+
+	if (fds[0].revents)
+	{
+		char drain[64];
+		while (read(wakeRead, drain, sizeof(drain)) > 0)
+			;
+	}
+
+	std::lock_guard<std::mutex> lock(sourcesMutex);
+	for (size_t i = 0; i < watched.size(); ++i)
+	{
+		// may have been removed or have moved to another socket while we were asleep
+		auto* source = watched[i];
+		if (fds[i + 1].revents && std::find(sources.begin(), sources.end(), source) != sources.end() && source->watchedFd == fds[i + 1].fd)
+			source->ready = true;
+	}
+}
+
+void IoReactor::Wake()
+{
+	int fd = wakeWrite;
+	if (fd != -1)
+	{
+		char value = 1;
+		(void)!write(fd, &value, sizeof(value));
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(waitMutex);
+		woken = true;
+	}
+	activity.notify_one();
+}
+#else
+bool IoReactor::OpenWaitHandles()
+{
+	// pipes have no handle to wait on together with a wake event, they are polled
+	return false;
+}
+
+void IoReactor::CloseWaitHandles()
+{
+}
+
+void IoReactor::Watch(IoThread* source, const IoWait& wait)
+{
+	source->watchedFd = wait.handle;
+	source->watchedWrite = wait.writable;
+}
+
+void IoReactor::WaitHandles(int64_t timeout)
+{
+	WaitSignal(timeout);
+}
+
+void IoReactor::Wake()
+{
+	{
+		std::lock_guard<std::mutex> lock(waitMutex);
+		woken = true;
+	}
+	activity.notify_one();
+}
+#endif
+
 IoThread::~IoThread()
 {
 	Stop();
 }
 
-void IoThread::Start(UpdateFunc update)
+void IoThread::Start(UpdateFunc update, WaitFunc wait)
 {
+	if (registered)
+		return;
+
 	callback = update;
-	thread = std::jthread([&](std::stop_token token)
-	{
-		constexpr std::chrono::milliseconds maxWait{500};
-		std::unique_lock<std::mutex> lock(waitForIOMutex);
-		do
-		{
-			callback();
-			waitForIOActivity.wait_for(lock, maxWait);
-		} while (!token.stop_requested());
-	});
+	waitHint = wait;
+	registered = true;
+	IoReactor::Get().Add(this);
 }
 
 void IoThread::Notify()
 {
-	waitForIOActivity.notify_one();
+	if (!registered)
+		return;
+
+	notified = true;
+	IoReactor::Get().Wake();
 }
 
 void IoThread::Stop()
 {
-	if (!thread.joinable())
+	if (!registered)
 		return;
 
-	thread.request_stop();
-	Notify();
-	thread.join();
+	IoReactor::Get().Remove(this);
+	registered = false;
+}
+
+uint64_t IoThread::GetWakeupCount() const
+{
+	return wakeups.load(std::memory_order_relaxed);
 }
 #else
 IoThread::~IoThread()
 {
 }
 
-void IoThread::Start(std::function<void()> update)
+void IoThread::Start(UpdateFunc, WaitFunc)
 {
 }
 
@@ -51,4 +437,9 @@ void IoThread::Notify()
 void IoThread::Stop()
 {
 }
+
+uint64_t IoThread::GetWakeupCount() const
+{
+	return 0;
+}
 #endif
@@ -1,29 +1,57 @@
 #pragma once
 
 #ifndef DISCORD_DISABLE_IO_THREAD
-	#include <condition_variable>
-	#include <mutex>
-	#include <thread>
+	#include <atomic>
+	#include <chrono>
 #endif
 
+#include <cstdint>
 #include <functional>
 
+// how often to pump connections whose handle can't be waited on
+constexpr int64_t IoPollInterval = 500;
+
+// what the io thread should sleep on until the next update
+struct IoWait
+{
+	// socket to watch for input, -1 if there is none
+	int handle{-1};
+	// milliseconds until the next timed action, -1 to wait for activity only
+	int64_t timeout{-1};
+	// also wake when the socket can take more output
+	bool writable{false};
+};
+
+// one instance's registration with the io thread; a single thread pumps every instance in the process
 class IoThread
 {
 private:
 	using UpdateFunc = std::function<void()>;
+	using WaitFunc = std::function<IoWait()>;
 
 #ifndef DISCORD_DISABLE_IO_THREAD
-	std::mutex waitForIOMutex;
-	std::condition_variable waitForIOActivity;
-	std::jthread thread;
+	friend class IoReactor;
+
 	UpdateFunc callback;
+	WaitFunc waitHint;
+	bool registered{false};
+	std::atomic_bool notified{false};
+	std::atomic_uint64_t wakeups{0};
+
+	// owned by the io thread, guarded by its source list lock
+	bool ready{false};
+	int watchedFd{-1};
+	bool watchedWrite{false};
+	bool hasDeadline{false};
+	std::chrono::steady_clock::time_point deadline;
 #endif
 
 public:
 	~IoThread();
 
-	void Start(UpdateFunc update);
+	void Start(UpdateFunc update, WaitFunc wait);
 	void Notify();
 	void Stop();
+
+	uint64_t GetWakeupCount() const;
 };
@@ -0,0 +1,155 @@
+#include "json_escape.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define DISCORD_ESCAPE_X86
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define DISCORD_TARGET_AVX2
+	#else
+		#define DISCORD_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#endif
+
+static inline bool NeedsEscape(char c)
+{
+	return (unsigned char)c < 0x20 || c == '"' || c == '\\';
+}
+
+static const char* FindJsonEscapeScalar(const char* text, const char* end)
+{
+	while (text < end && !NeedsEscape(*text))
+		++text;
+	return text;
+}
+
+#ifdef DISCORD_ESCAPE_X86
+static inline int LowestBit(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// bit per byte of chunk that needs escaping
+static inline unsigned EscapeMaskSSE2(__m128i chunk)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1F);
+
+	// unsigned c <= 0x1F is min(c, 0x1F) == c
+	__m128i hits = _mm_or_si128(
+		_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+		_mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+	return (unsigned)_mm_movemask_epi8(hits);
+}
+
+static const char* FindJsonEscapeSSE2(const char* text, const char* end)
+{
+	if (end - text >= 16)
+	{
+		for (; end - text >= 16; text += 16)
+		{
+			unsigned mask = EscapeMaskSSE2(_mm_loadu_si128((const __m128i*)text));
+			if (mask)
+				return text + LowestBit(mask);
+		}
+		if (text == end)
+			return end;
+
+		// the last chunk ends at end and overlaps bytes already found clean
+		text = end - 16;
+		unsigned mask = EscapeMaskSSE2(_mm_loadu_si128((const __m128i*)text));
+		return mask ? text + LowestBit(mask) : end;
+	}
+
+	if (end - text >= 8)
+	{
+		// two 8 byte halves that may overlap, the zeroed upper bytes of each load don't count
+		unsigned mask = EscapeMaskSSE2(_mm_loadl_epi64((const __m128i*)text)) & 0xFF;
+		if (mask)
+			return text + LowestBit(mask);
+		text = end - 8;
+		mask = EscapeMaskSSE2(_mm_loadl_epi64((const __m128i*)text)) & 0xFF;
+		return mask ? text + LowestBit(mask) : end;
+	}
+	return FindJsonEscapeScalar(text, end);
+}
+
+DISCORD_TARGET_AVX2 static inline unsigned EscapeMaskAVX2(__m256i chunk)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i control = _mm256_set1_epi8(0x1F);
+
+	__m256i hits = _mm256_or_si256(
+		_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+		_mm256_cmpeq_epi8(_mm256_min_epu8(chunk, control), chunk));
+	return (unsigned)_mm256_movemask_epi8(hits);
+}
+
+DISCORD_TARGET_AVX2 static const char* FindJsonEscapeAVX2(const char* text, const char* end)
+{
+	// shorter fields go to non-VEX code, which stalls on dirty upper halves of the ymm registers
+	if (end - text < 32)
+	{
+		_mm256_zeroupper();
+		return FindJsonEscapeSSE2(text, end);
+	}
+
+	for (; end - text >= 32; text += 32)
+	{
+		unsigned mask = EscapeMaskAVX2(_mm256_loadu_si256((const __m256i*)text));
+		if (mask)
+			return text + LowestBit(mask);
+	}
+	if (text == end)
+		return end;
+
+	text = end - 32;
+	unsigned mask = EscapeMaskAVX2(_mm256_loadu_si256((const __m256i*)text));
+	return mask ? text + LowestBit(mask) : end;
+}
+
+static bool HasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// cpu has avx2 and the os saves ymm registers
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	__cpuidex(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+	return osxsave && avx2 && (_xgetbv(0) & 6) == 6;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+using FindJsonEscapeFunc = const char* (*)(const char* text, const char* end);
+
+static FindJsonEscapeFunc SelectFindJsonEscape()
+{
+#ifdef DISCORD_ESCAPE_X86
+	return HasAVX2() ? FindJsonEscapeAVX2 : FindJsonEscapeSSE2;
+#else
+	return FindJsonEscapeScalar;
+#endif
+}
+
+const char* FindJsonEscape(const char* text, const char* end)
+{
+	static const FindJsonEscapeFunc find = SelectFindJsonEscape();
+	return find(text, end);
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// first character in [text, end) json needs escaped (quote, backslash or control character), end if none;
+// picks the widest vector kernel the cpu supports on first use
+const char* FindJsonEscape(const char* text, const char* end);
@@ -0,0 +1,102 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include "discord_rpc.hpp"
+
+using LatencyClock = std::chrono::steady_clock;
+
+// timing costs a clock read per update, it is only built in on request (ENABLE_LATENCY_STATS)
+#ifdef DISCORD_ENABLE_LATENCY_STATS
+constexpr bool LatencyStatsEnabled = true;
+#else
+constexpr bool LatencyStatsEnabled = false;
+#endif
+
+// start of a latency sample, a default time point when latency stats are not built in
+inline LatencyClock::time_point LatencyStart()
+{
+	if constexpr (LatencyStatsEnabled)
+		return LatencyClock::now();
+	else
+		return {};
+}
+
+// log-linear histogram of microsecond latencies, 4 buckets per power of two (~25% resolution)
+// any thread may record or read a summary; recording does nothing without latency stats
+class LatencyHistogram
+{
+	static constexpr int SubBuckets = 4;
+	static constexpr int BucketCount = 42 * SubBuckets;
+
+	std::atomic_uint64_t buckets[BucketCount]{};
+	std::atomic_uint64_t samples{0};
+	std::atomic_uint64_t max{0};
+
+	static int BucketIndex(uint64_t value)
+	{
+		if (value < SubBuckets)
+			return (int)value;
+
+		int exponent = (int)std::bit_width(value) - 1;
+		int sub = (int)((value >> (exponent - 2)) & (SubBuckets - 1));
+		int index = (exponent - 1) * SubBuckets + sub;
+		return index < BucketCount ? index : BucketCount - 1;
+	}
+
+	// largest value that lands in the bucket
+	static uint64_t BucketLimit(int index)
+	{
+		if (index < SubBuckets)
+			return (uint64_t)index;
+
+		int exponent = index / SubBuckets + 1;
+		uint64_t step = 1ull << (exponent - 2);
+		return (SubBuckets + (uint64_t)(index % SubBuckets)) * step + step - 1;
+	}
+
+	uint64_t Percentile(uint64_t total, uint64_t perMille) const
+	{
+		uint64_t rank = (total * perMille + 999) / 1000;
+		uint64_t largest = max.load(std::memory_order_relaxed);
+		uint64_t seen = 0;
+		for (int i = 0; i < BucketCount; ++i)
+		{
+			seen += buckets[i].load(std::memory_order_relaxed);
+			if (seen >= rank)
+				return BucketLimit(i) < largest ? BucketLimit(i) : largest;
+		}
+		return largest;
+	}
+
+public:
+	void Record(LatencyClock::time_point since)
+	{
+		if constexpr (!LatencyStatsEnabled)
+			return;
+
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(LatencyClock::now() - since).count();
+		uint64_t value = elapsed > 0 ? (uint64_t)elapsed : 0;
+
+		buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+		samples.fetch_add(1, std::memory_order_relaxed);
+		uint64_t largest = max.load(std::memory_order_relaxed);
+		while (value > largest && !max.compare_exchange_weak(largest, value, std::memory_order_relaxed))
+			;
+	}
+
+	CDiscordLatency GetSummary() const
+	{
+		CDiscordLatency summary{};
+		summary.samples = samples.load(std::memory_order_relaxed);
+		if (summary.samples == 0)
+			return summary;
+
+		summary.p50 = Percentile(summary.samples, 500);
+		summary.p99 = Percentile(summary.samples, 990);
+		summary.p999 = Percentile(summary.samples, 999);
+		summary.max = max.load(std::memory_order_relaxed);
+		return summary;
+	}
+};
@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include "loopback_transport.h"
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+ByteRing::ByteRing(size_t capacity)
+{
+	capacity = std::bit_ceil(capacity);
+	buffer = std::make_unique<char[]>(capacity);
+	mask = capacity - 1;
+}
+
+size_t ByteRing::Writable() const
+{
+	return mask + 1 - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+}
+
+size_t ByteRing::Readable() const
+{
+	return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+}
+
+size_t ByteRing::Write(const void* data, size_t length)
+{
+	size_t position = head.load(std::memory_order_relaxed);
+	length = std::min(length, Writable());
+
+	// copy may wrap around the end of the buffer
+	size_t offset = position & mask;
+	size_t first = std::min(length, mask + 1 - offset);
+	memcpy(buffer.get() + offset, data, first);
+	memcpy(buffer.get(), (const char*)data + first, length - first);
+
+	head.store(position + length, std::memory_order_release);
+	return length;
+}
+
+size_t ByteRing::Read(void* data, size_t length)
+{
+	size_t position = tail.load(std::memory_order_relaxed);
+	length = std::min(length, Readable());
+
+	size_t offset = position & mask;
+	size_t first = std::min(length, mask + 1 - offset);
+	memcpy(data, buffer.get() + offset, first);
+	memcpy((char*)data + first, buffer.get(), length - first);
+
+	tail.store(position + length, std::memory_order_release);
+	return length;
+}
+
+void ByteRing::Discard()
+{
+	tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+LoopbackTransport::Channel::Channel(size_t capacity) : rings{ByteRing(capacity), ByteRing(capacity)}
+{
+#ifndef _WIN32
+	for (auto& fds : wake)
+	{
+		if (pipe(fds) != 0)
+		{
+			fds[0] = fds[1] = -1;
+			continue;
+		}
+		for (int fd : fds)
+		{
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+	}
+#endif
+}
+
+LoopbackTransport::Channel::~Channel()
+{
+#ifndef _WIN32
+	for (auto& fds : wake)
+		for (int fd : fds)
+			if (fd != -1)
+				close(fd);
+#endif
+}
+
+void LoopbackTransport::Channel::Signal(int side)
+{
+#ifndef _WIN32
+	// the ring update before this is seen by whoever clears the flag
+	if (wake[side][1] != -1 && !signalled[side].exchange(true))
+	{
+		char byte = 0;
+		[[maybe_unused]] auto result = write(wake[side][1], &byte, 1);
+	}
+#endif
+}
+
+void LoopbackTransport::Channel::ClearSignal(int side)
+{
+#ifndef _WIN32
+	// with the byte still on its way the flag stays, the pipe turns readable again once it lands
+	char byte;
+	if (signalled[side].load(std::memory_order_acquire) && read(wake[side][0], &byte, 1) == 1)
+		signalled[side].exchange(false);
+#endif
+}
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<Channel> channel, int side) : channel(std::move(channel)), side(side)
+{
+}
+
+LoopbackTransport::Pair LoopbackTransport::CreatePair(size_t capacity)
+{
+	auto channel = std::make_shared<Channel>(capacity);
+	return Pair(std::unique_ptr<LoopbackTransport>(new LoopbackTransport(channel, 0)),
+				std::unique_ptr<LoopbackTransport>(new LoopbackTransport(channel, 1)));
+}
+
+bool LoopbackTransport::Open()
+{
+	// fresh stream, anything left over from an earlier session is dropped
+	channel->ClearSignal(side);
+	channel->writeStalled[side] = false;
+	channel->rings[side].Discard();
+	peerSeen = false;
+	channel->open[side] = true;
+	channel->Signal(side ^ 1);
+	return true;
+}
+
+bool LoopbackTransport::PeerClosed()
+{
+	if (channel->open[side ^ 1])
+	{
+		peerSeen = true;
+		return false;
+	}
+	return peerSeen;
+}
+
+void LoopbackTransport::Close()
+{
+	channel->open[side] = false;
+	channel->Signal(side ^ 1);
+}
+
+bool LoopbackTransport::IsOpen() const
+{
+	return channel->open[side];
+}
+
+int LoopbackTransport::GetHandle() const
+{
+	// the read side of a pipe never reports writable, a full ring is waited out through the peer's signal
+	return channel->open[side] ? channel->wake[side][0] : -1;
+}
+
+size_t LoopbackTransport::Write(const ConnectionBuffer* buffers, size_t count)
+{
+	if (!channel->open[side])
+		return 0;
+
+	if (PeerClosed())
+	{
+		channel->open[side] = false;
+		return 0;
+	}
+	// the other end drops whatever it finds when it opens, hold on like a full socket until then
+	if (!peerSeen)
+		return 0;
+
+	// takes what fits like a non-blocking socket
+	auto& ring = channel->rings[side ^ 1];
+	size_t written = 0;
+	bool full = false;
+	for (size_t i = 0; i < count && !full; ++i)
+	{
+		size_t length = ring.Write(buffers[i].data, buffers[i].length);
+		written += length;
+		full = length < buffers[i].length;
+	}
+	if (written)
+		channel->Signal(side ^ 1);
+
+	if (full)
+	{
+		// pairs with the fence in Read, either the peer sees the flag or this sees the space it made
+		channel->writeStalled[side] = true;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (ring.Writable() && channel->writeStalled[side].exchange(false))
+			channel->Signal(side);
+	}
+	return written;
+}
+
+size_t LoopbackTransport::Read(void* data, size_t length)
+{
+	if (!channel->open[side])
+		return 0;
+
+	auto& ring = channel->rings[side];
+	size_t read = ring.Read(data, length);
+	if (read == 0)
+	{
+		// caught up, the signal is taken before looking again so a write racing this leaves a new one
+		channel->ClearSignal(side);
+		read = ring.Read(data, length);
+	}
+
+	if (read)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (channel->writeStalled[side ^ 1].load(std::memory_order_relaxed) && channel->writeStalled[side ^ 1].exchange(false))
+			channel->Signal(side ^ 1);
+	}
+	else if (PeerClosed())
+		channel->open[side] = false;
+
+	return read;
+}
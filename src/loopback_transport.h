@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <utility>
+#include "transport.h"
+
+// lock-free byte ring, one thread writes and one thread reads
+class ByteRing
+{
+	std::unique_ptr<char[]> buffer;
+	size_t mask;
+	alignas(64) std::atomic_size_t head{0};
+	alignas(64) std::atomic_size_t tail{0};
+
+public:
+	explicit ByteRing(size_t capacity);
+
+	size_t Writable() const;
+	size_t Readable() const;
+
+	// both copy as much as fits and return the amount
+	size_t Write(const void* data, size_t length);
+	size_t Read(void* data, size_t length);
+
+	// reader side only, drops everything written so far
+	void Discard();
+};
+
+// in-process transport, ends of a pair are connected through two byte rings
+// an end waits for the other one to open, once it has seen it open a close reads as end of stream
+// outside Windows each end has a pipe that turns readable when its peer writes, reads, opens or closes,
+// that is the handle the io thread waits on; on Windows, or if the pipe can't be made, it is polled
+class LoopbackTransport : public Transport
+{
+	struct Channel
+	{
+		ByteRing rings[2];
+		std::atomic_bool open[2]{};
+		// per end, read and write side of its wake pipe, -1 without one
+		int wake[2][2]{{-1, -1}, {-1, -1}};
+		// per end, a byte is in its wake pipe or on its way there; keeps it at one byte however often it is signalled
+		std::atomic_bool signalled[2]{};
+		// per end, its last write stopped at a full ring, the peer signals it when it has read
+		std::atomic_bool writeStalled[2]{};
+
+		explicit Channel(size_t capacity);
+		~Channel();
+
+		void Signal(int side);
+		void ClearSignal(int side);
+	};
+
+	std::shared_ptr<Channel> channel;
+	int side;
+	// the other end was open at some point since this one opened
+	std::atomic_bool peerSeen{false};
+
+	bool PeerClosed();
+
+	LoopbackTransport(std::shared_ptr<Channel> channel, int side);
+
+public:
+	using Pair = std::pair<std::unique_ptr<LoopbackTransport>, std::unique_ptr<LoopbackTransport>>;
+	static Pair CreatePair(size_t capacity = 1024 * 1024);
+
+	bool Open() override;
+	void Close() override;
+	bool IsOpen() const override;
+	int GetHandle() const override;
+
+	using Transport::Write;
+	size_t Write(const ConnectionBuffer* buffers, size_t count) override;
+	size_t Read(void* data, size_t length) override;
+};
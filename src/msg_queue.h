@@ -1,32 +1,65 @@
 #pragma once
 #include <atomic>
+#include <cstdint>
 
-// No locks, but only works with a single thread as producer and a single thread as a consumer
+// No locks, any number of threads may add while a single thread consumes
+// Each slot carries a sequence number: it says whether the slot is free for the add with
+// that ticket or holds a committed message, so a claimed but unfinished slot is never read
+// When full, adds are rejected and counted; the queued messages are never overwritten
 
 template <typename ElementType, size_t QueueSize>
 class MsgQueue
 {
     ElementType queue_[QueueSize];
-    std::atomic_uint nextAdd_{0};
-    std::atomic_uint nextSend_{0};
-    std::atomic_uint pendingSends_{0};
+    std::atomic_size_t sequence_[QueueSize];
+    alignas(64) std::atomic_size_t nextAdd_{0};
+    alignas(64) size_t nextSend_{0};
+    alignas(64) std::atomic_uint64_t dropped_{0};
 
 public:
-    ElementType* GetNextAddMessage()
+    MsgQueue()
     {
-        if (pendingSends_.load() >= QueueSize)
-            return nullptr;
+        for (size_t i = 0; i < QueueSize; ++i)
+            sequence_[i].store(i, std::memory_order_relaxed);
+    }
 
-        auto index = (nextAdd_++) % QueueSize;
-        return &queue_[index];
+    // slot to fill, nullptr if the queue is full; hand it back to CommitAdd once filled
+    ElementType* GetNextAddMessage()
+    {
+        size_t add = nextAdd_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            size_t index = add % QueueSize;
+            intptr_t distance = (intptr_t)(sequence_[index].load(std::memory_order_acquire) - add);
+            if (distance == 0)
+            {
+                if (nextAdd_.compare_exchange_weak(add, add + 1, std::memory_order_relaxed))
+                    return &queue_[index];
+            }
+            else if (distance < 0)
+            {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            else
+                add = nextAdd_.load(std::memory_order_relaxed);
+        }
+    }
+    void CommitAdd(ElementType* message)
+    {
+        size_t index = (size_t)(message - queue_);
+        sequence_[index].store(sequence_[index].load(std::memory_order_relaxed) + 1, std::memory_order_release);
     }
-    void CommitAdd() { ++pendingSends_; }
 
-    bool HavePendingSends() const { return pendingSends_.load() != 0; }
-    ElementType* GetNextSendMessage()
+    // consumer side from here on
+    bool HavePendingSends() const { return sequence_[nextSend_ % QueueSize].load(std::memory_order_acquire) == nextSend_ + 1; }
+    ElementType* GetNextSendMessage() { return &queue_[nextSend_ % QueueSize]; }
+    void CommitSend()
     {
-        auto index = (nextSend_++) % QueueSize;
-        return &queue_[index];
+        sequence_[nextSend_ % QueueSize].store(nextSend_ + QueueSize, std::memory_order_release);
+        ++nextSend_;
     }
-    void CommitSend() { --pendingSends_; }
+
+    // adds rejected because the queue was full
+    uint64_t GetDropped() const { return dropped_.load(std::memory_order_relaxed); }
 };
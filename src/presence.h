@@ -1,12 +1,28 @@
 #pragma once
 #include <atomic>
+#include <cstdint>
 #include <cstring>
-#include <mutex>
+#include <memory>
+#include "discord_rpc.hpp"
+#include "fixed_string.h"
+#include "latency_histogram.h"
 
+// documented limits of presence strings in bytes; longer values are cut on a character boundary
+// by every serializer, so deferred and immediate updates send the same activity
+constexpr size_t MaxPresenceString = 128;
+constexpr size_t MaxPresenceImageKey = 32;
+// longest SET_ACTIVITY: eight text fields and two image keys at their limits with every byte
+// escaped to \u00XX, plus member names, numbers and framing
+constexpr size_t MaxPresenceCommand = 8 * MaxPresenceString * 6 + 2 * MaxPresenceImageKey * 6 + 1024;
+
+// serialized command; storage is allocated on demand and grows to the longest one held,
+// so a copy costs what the command takes rather than the worst case
 struct Buffer
 {
 	size_t length{};
-	char buffer[16 * 1024]{};
+	size_t capacity{};
+	// only the first length bytes are ever read or copied
+	std::unique_ptr<char[]> buffer;
 
 	Buffer()
 	{
@@ -15,47 +31,180 @@ struct Buffer
 
 	Buffer(const Buffer& other)
 	{
-		length = other.length;
-		memcpy(buffer, other.buffer, length);
+		*this = other;
 	}
 
 	Buffer& operator =(const Buffer& other)
 	{
+		Reserve(other.length);
 		length = other.length;
-		memcpy(buffer, other.buffer, length);
-		
+		if (length)
+			memcpy(buffer.get(), other.buffer.get(), length);
+
 		return *this;
 	}
+
+	// room for at least size bytes; what was held is lost if the storage has to grow
+	void Reserve(size_t size)
+	{
+		if (size <= capacity)
+			return;
+
+		buffer.reset(new char[size]);
+		capacity = size;
+	}
 };
 
-class PresenceEvent
+// owned copy of a presence, serialized later on the io thread
+struct PresenceSnapshot
 {
-	std::atomic_bool awaiting{false};
-	std::mutex mutex;
-	Buffer data;
+	bool clear{false};
+	FixedString<MaxPresenceString + 1> state;
+	FixedString<MaxPresenceString + 1> details;
+	int64_t startTimestamp{0};
+	int64_t endTimestamp{0};
+	FixedString<MaxPresenceImageKey + 1> largeImageKey;
+	FixedString<MaxPresenceString + 1> largeImageText;
+	FixedString<MaxPresenceImageKey + 1> smallImageKey;
+	FixedString<MaxPresenceString + 1> smallImageText;
+	FixedString<MaxPresenceString + 1> partyId;
+	int partySize{0};
+	int partyMax{0};
+	DiscordPartyPrivacy partyPrivacy{DISCORD_PARTY_PRIVATE};
+	FixedString<MaxPresenceString + 1> matchSecret;
+	FixedString<MaxPresenceString + 1> joinSecret;
+	FixedString<MaxPresenceString + 1> spectateSecret;
+	int8_t instance{0};
+
+	PresenceSnapshot()
+	{
+
+	}
+
+	PresenceSnapshot(const CDiscordRichPresence* presence)
+	{
+		clear = presence == nullptr;
+		if (clear)
+			return;
+
+		state = presence->state;
+		details = presence->details;
+		startTimestamp = presence->startTimestamp;
+		endTimestamp = presence->endTimestamp;
+		largeImageKey = presence->largeImageKey;
+		largeImageText = presence->largeImageText;
+		smallImageKey = presence->smallImageKey;
+		smallImageText = presence->smallImageText;
+		partyId = presence->partyId;
+		partySize = presence->partySize;
+		partyMax = presence->partyMax;
+		partyPrivacy = presence->partyPrivacy;
+		matchSecret = presence->matchSecret;
+		joinSecret = presence->joinSecret;
+		spectateSecret = presence->spectateSecret;
+		instance = presence->instance;
+	}
+
+	// views into this snapshot, valid while it is alive and unchanged
+	CDiscordRichPresence View()
+	{
+		CDiscordRichPresence presence;
+		presence.state = state;
+		presence.details = details;
+		presence.startTimestamp = startTimestamp;
+		presence.endTimestamp = endTimestamp;
+		presence.largeImageKey = largeImageKey;
+		presence.largeImageText = largeImageText;
+		presence.smallImageKey = smallImageKey;
+		presence.smallImageText = smallImageText;
+		presence.partyId = partyId;
+		presence.partySize = partySize;
+		presence.partyMax = partyMax;
+		presence.partyPrivacy = partyPrivacy;
+		presence.matchSecret = matchSecret;
+		presence.joinSecret = joinSecret;
+		presence.spectateSecret = spectateSecret;
+		presence.instance = instance;
+		return presence;
+	}
+};
+
+// latest value handed from the caller to the io thread, older unsent values are overwritten
+// triple buffered: the caller fills its own slot and swaps it in, the io thread swaps out the newest
+// and reads it in place, neither side waits on the other
+template <typename Data>
+class LatestEvent
+{
+	static constexpr uint8_t SlotIndex = 3;
+	// set while the shared slot holds a value the io thread hasn't taken
+	static constexpr uint8_t Fresh = 4;
+
+	struct Slot
+	{
+		Data data;
+		LatencyClock::time_point setTime;
+	};
+
+	Slot slots[3];
+	// caller's slot
+	uint8_t back{0};
+	// io thread's slot, valid from Consume until the next one
+	uint8_t front{1};
+	alignas(64) std::atomic_uint8_t shared{2};
+	std::atomic_uint64_t overwritten{0};
 
 public:
-	inline void Set(const Buffer& data)
+	inline void Set(const Data& data, LatencyClock::time_point setTime = LatencyStart())
+	{
+		slots[back].data = data;
+		slots[back].setTime = setTime;
+		uint8_t previous = shared.exchange(back | Fresh, std::memory_order_acq_rel);
+		back = previous & SlotIndex;
+		// only the caller writes the count, so it needs no locked add on top of the exchange
+		if (previous & Fresh)
+			overwritten.store(overwritten.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	// io thread, puts back the value it took when it couldn't be sent, unless a newer one arrived meanwhile
+	inline void Restore()
 	{
-		std::lock_guard lock(mutex);
-		this->data = data;
-		awaiting = true;
+		uint8_t expected = shared.load(std::memory_order_acquire);
+		if (!(expected & Fresh) && shared.compare_exchange_strong(expected, front | Fresh, std::memory_order_acq_rel))
+			front = expected & SlotIndex;
 	}
 
+	// io thread, takes the newest value if there is one
 	inline bool Consume()
 	{
-		return awaiting.exchange(false);
+		if (!IsPending())
+			return false;
+
+		front = shared.exchange(front, std::memory_order_acq_rel) & SlotIndex;
+		return true;
+	}
+
+	// io thread, the value taken by the last Consume
+	inline Data& Get(LatencyClock::time_point& setTime)
+	{
+		setTime = slots[front].setTime;
+		return slots[front].data;
 	}
 
-	inline Buffer GetBuffer()
+	inline bool IsPending() const
 	{
-		std::lock_guard lock(mutex);
-		return data;
+		return shared.load(std::memory_order_acquire) & Fresh;
 	}
 
 	inline void Reset()
 	{
-		data.length = 0;
 		Consume();
 	}
+
+	inline uint64_t GetOverwritten() const
+	{
+		return overwritten.load(std::memory_order_relaxed);
+	}
 };
+
+using PresenceEvent = LatestEvent<Buffer>;
+using SnapshotEvent = LatestEvent<PresenceSnapshot>;
@@ -0,0 +1,161 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Variable length records packed into one byte ring, each stored contiguously behind a header
+// No locks, any number of threads may add while a single thread consumes
+// Producers claim space with a CAS and fill it in any order; the consumer stops at the first
+// record whose header isn't committed yet, so records are read in the order they were claimed
+// When full, adds are rejected and counted; the queued records are never overwritten
+
+template <size_t Capacity>
+class RecordQueue
+{
+    struct Header
+    {
+        // bytes claimed, header included; set before the record is committed
+        uint32_t size;
+        // 0 until committed, then Committed with the payload length or Skip
+        uint32_t state;
+    };
+
+    static constexpr uint32_t Committed = 0x80000000u;
+    // fills the end of the ring when the next record doesn't fit before it
+    static constexpr uint32_t Skip = Committed | 0x7fffffffu;
+
+    // records start on a header boundary, so a header never straddles the end of the ring
+    static_assert(Capacity % sizeof(Header) == 0);
+
+    // zero where nothing is claimed, the consumer clears what it releases
+    alignas(sizeof(Header)) char ring_[Capacity]{};
+    // running byte counts, the ring position is the count modulo Capacity
+    alignas(64) std::atomic_size_t head_{0};
+    alignas(64) std::atomic_size_t tail_{0};
+    size_t peekEnd_{0};
+    alignas(64) std::atomic_uint64_t dropped_{0};
+
+    static size_t RecordSize(size_t length)
+    {
+        return (sizeof(Header) + length + sizeof(Header) - 1) & ~(sizeof(Header) - 1);
+    }
+
+    Header* HeaderAt(size_t position) { return (Header*)(ring_ + position % Capacity); }
+
+    static std::atomic_ref<uint32_t> State(Header* header) { return std::atomic_ref<uint32_t>(header->state); }
+
+public:
+    // room for up to maxLength bytes, nullptr if the ring is full; Commit with the length actually written
+    // what is claimed past that length stays taken until the record is released, so reserve what it needs
+    // anything up to half the capacity is sure to fit once the consumer catches up
+    char* Reserve(size_t maxLength)
+    {
+        size_t size = RecordSize(maxLength);
+        if (size > Capacity)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t skip;
+        for (;;)
+        {
+            size_t tail = tail_.load(std::memory_order_acquire);
+            // the consumer may have released records claimed after head was read
+            if (tail > head)
+            {
+                head = head_.load(std::memory_order_acquire);
+                continue;
+            }
+
+            size_t offset = head % Capacity;
+            skip = size > Capacity - offset ? Capacity - offset : 0;
+            if (head + skip + size - tail > Capacity)
+            {
+                // only full if nobody claimed space since head was read
+                size_t current = head_.load(std::memory_order_acquire);
+                if (current != head)
+                {
+                    head = current;
+                    continue;
+                }
+
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            if (head_.compare_exchange_weak(head, head + skip + size, std::memory_order_acquire))
+                break;
+        }
+
+        if (skip)
+        {
+            Header* marker = HeaderAt(head);
+            marker->size = (uint32_t)skip;
+            State(marker).store(Skip, std::memory_order_release);
+        }
+
+        Header* header = HeaderAt(head + skip);
+        header->size = (uint32_t)size;
+        return (char*)(header + 1);
+    }
+    void Commit(char* record, size_t length)
+    {
+        Header* header = (Header*)record - 1;
+        State(header).store(Committed | (uint32_t)length, std::memory_order_release);
+    }
+
+    bool HavePendingSends() const { return head_.load(std::memory_order_acquire) != tail_.load(std::memory_order_acquire); }
+
+    // consumer side from here on
+    // oldest committed records, in place and without removing them; Release drops what was returned
+    size_t Peek(std::string_view* records, size_t maxRecords)
+    {
+        size_t position = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t count = 0;
+        while (position != head && count < maxRecords)
+        {
+            Header* header = HeaderAt(position);
+            uint32_t state = State(header).load(std::memory_order_acquire);
+            if (state == 0)
+                break;
+
+            if (state != Skip)
+                records[count++] = {(const char*)(header + 1), state & ~Committed};
+            position += header->size;
+        }
+        peekEnd_ = position;
+        return count;
+    }
+    void Release()
+    {
+        // claimed space must read as uncommitted until its producer commits it
+        size_t position = tail_.load(std::memory_order_relaxed);
+        while (position != peekEnd_)
+        {
+            Header* header = HeaderAt(position);
+            size_t size = header->size;
+            memset((void*)header, 0, size);
+            position += size;
+        }
+        tail_.store(position, std::memory_order_release);
+    }
+    // drops everything committed
+    void Clear()
+    {
+        std::string_view records[16];
+        for (;;)
+        {
+            Peek(records, 16);
+            if (peekEnd_ == tail_.load(std::memory_order_relaxed))
+                break;
+            Release();
+        }
+    }
+
+    // adds rejected because the ring was full
+    uint64_t GetDropped() const { return dropped_.load(std::memory_order_relaxed); }
+};
@@ -1,4 +1,4 @@
-#include <atomic>
+#include <algorithm>
 #include "rpc_connection.h"
 #include "serialization.h"
 
@@ -15,33 +15,38 @@ void RpcConnection::SetApplicationId(const std::string_view& id)
 	appId = id;
 }
 
+void RpcConnection::SetTransport(Transport* newTransport)
+{
+	transport = newTransport ? newTransport : &connection;
+}
+
 void RpcConnection::Open()
 {
 	if (state == State::Disconnected)
 	{
-		if (!connection.Open())
+		if (!transport->Open())
 			return;
 
-		frame.opcode = Opcode::Handshake;
-		frame.length = (uint32_t)JsonWriteHandshakeObj(frame.message, sizeof(frame.message), RpcVersion, &appId);
+		char handshake[256];
+		MessageFrameHeader header{Opcode::Handshake, 0};
+		header.length = (uint32_t)JsonWriteHandshakeObj(handshake, sizeof(handshake), RpcVersion, &appId);
 
-		if (connection.Write(&frame, sizeof(MessageFrameHeader) + frame.length))
+		ConnectionBuffer buffers[]{{&header, sizeof(header)}, {handshake, header.length}};
+		if (Send(buffers, 2))
 			state = State::Connecting;
-		else
-			Close();
 	}
 	else if (state == State::Connecting)
 	{
-		JsonDocument message;
-		if (Read(message))
+		Flush();
+		if (Read(document))
 		{
-			auto cmd = GetStrMember(&message, "cmd");
-			auto evt = GetStrMember(&message, "evt");
+			auto cmd = GetStrMember(&document, "cmd");
+			auto evt = GetStrMember(&document, "evt");
 			if (cmd && evt && strcmp(cmd, "DISPATCH") == 0 && strcmp(evt, "READY") == 0)
 			{
 				state = State::Connected;
 				if (onConnect)
-					onConnect(message);
+					onConnect(document);
 			}
 		}
 	}
@@ -52,79 +57,310 @@ void RpcConnection::Close()
 	if (state != State::Disconnected && onDisconnect)
 		onDisconnect(lastErrorCode, lastErrorMessage);
 
-	connection.Close();
-	state = State::Disconnected;
+	{
+		// a direct write may be using the handle
+		std::lock_guard<std::mutex> lock(writeMutex);
+		transport->Close();
+		state = State::Disconnected;
+		outbound.failed = false;
+		outbound.closes.fetch_add(1, std::memory_order_relaxed);
+		if (OutboundPending())
+			EndStall();
+	}
+	ResetInbound();
 	lastErrorCode = (int)ErrorCode::Success;
 	lastErrorMessage.clear();
 }
 
 bool RpcConnection::Write(const void* data, size_t length)
 {
-	if (length > sizeof(frame.message))
+	ConnectionBuffer payload{data, length};
+	return Write(&payload, 1);
+}
+
+bool RpcConnection::Write(const ConnectionBuffer* payloads, size_t count)
+{
+	constexpr size_t MaxFramesPerWrite = MaxConnectionBuffers / 2;
+
+	// headers and payloads go out in gathered writes, straight from the caller's buffers
+	MessageFrameHeader headers[MaxFramesPerWrite];
+	ConnectionBuffer buffers[MaxConnectionBuffers];
+	size_t frames = 0;
+
+	auto send = [&]() {
+		outbound.frames.fetch_add(frames, std::memory_order_relaxed);
+		bool sent = Send(buffers, frames * 2);
+		frames = 0;
+		return sent;
+	};
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto& payload = payloads[i];
+		// Discord would drop the connection over it, it is left out instead of failing the frames beside it
+		if (payload.length > MaxRpcPayloadSize)
+		{
+			outbound.oversized.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+
+		headers[frames] = {Opcode::Frame, (uint32_t)payload.length};
+		buffers[frames * 2] = {&headers[frames], sizeof(MessageFrameHeader)};
+		buffers[frames * 2 + 1] = payload;
+		if (++frames == MaxFramesPerWrite && !send())
+			return false;
+	}
+	return frames == 0 || send();
+}
+
+bool RpcConnection::WriteDirect(const void* data, size_t length, bool& queued)
+{
+	// the io thread holds the lock while it writes, it takes the frame instead
+	std::unique_lock<std::mutex> lock(writeMutex, std::try_to_lock);
+	if (!lock || state != State::Connected || outbound.failed || OutboundPending())
+		return false;
+	if (length > MaxRpcPayloadSize)
 		return false;
 
-	frame.opcode = Opcode::Frame;
-	frame.length = (uint32_t)length;
-	memcpy(frame.message, data, length);
-	
-	if (!connection.Write(&frame, sizeof(MessageFrameHeader) + length))
+	MessageFrameHeader header{Opcode::Frame, (uint32_t)length};
+	ConnectionBuffer buffers[]{{&header, sizeof(header)}, {data, length}};
+	if (!SendLocked(buffers, 2))
 	{
-		Close();
+		// the io thread may be reading from the handle, closing is left to its next Flush
+		outbound.failed = true;
 		return false;
 	}
+
+	outbound.frames.fetch_add(1, std::memory_order_relaxed);
+	queued = OutboundPending();
 	return true;
 }
 
+bool RpcConnection::Send(const ConnectionBuffer* buffers, size_t count)
+{
+	{
+		std::lock_guard<std::mutex> lock(writeMutex);
+		if (SendLocked(buffers, count))
+			return true;
+	}
+	Close();
+	return false;
+}
+
+bool RpcConnection::SendLocked(const ConnectionBuffer* buffers, size_t count)
+{
+	// nothing may overtake bytes that are already waiting
+	size_t sent = 0;
+	if (!OutboundPending())
+	{
+		outbound.calls.fetch_add(1, std::memory_order_relaxed);
+		sent = transport->Write(buffers, count);
+		if (!transport->IsOpen())
+			return false;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t length = buffers[i].length;
+		if (sent >= length)
+		{
+			sent -= length;
+			continue;
+		}
+
+		if (!Enqueue((const char*)buffers[i].data + sent, length - sent))
+			return false;
+		sent = 0;
+	}
+	return true;
+}
+
+bool RpcConnection::Enqueue(const void* data, size_t length)
+{
+	size_t queued = outbound.end - outbound.start;
+	if (queued + length > MaxOutboundQueue)
+	{
+		lastErrorCode = (int)ErrorCode::WriteStalled;
+		lastErrorMessage = "Write queue full";
+		return false;
+	}
+
+	if (queued == 0)
+	{
+		outbound.stallStart = std::chrono::steady_clock::now();
+		outbound.stalls.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (outbound.end + length > outbound.capacity)
+	{
+		if (queued + length > outbound.capacity)
+		{
+			size_t capacity = std::max({queued + length, outbound.capacity * 2, InboundBufferSize});
+			auto buffer = std::unique_ptr<char[]>(new char[capacity]);
+			if (queued)
+				memcpy(buffer.get(), outbound.buffer.get() + outbound.start, queued);
+			outbound.buffer = std::move(buffer);
+			outbound.capacity = capacity;
+		}
+		else
+			memmove(outbound.buffer.get(), outbound.buffer.get() + outbound.start, queued);
+
+		outbound.start = 0;
+		outbound.end = queued;
+	}
+
+	memcpy(outbound.buffer.get() + outbound.end, data, length);
+	outbound.end += length;
+	outbound.queuedBytes = outbound.end - outbound.start;
+	return true;
+}
+
+bool RpcConnection::Flush()
+{
+	{
+		std::lock_guard<std::mutex> lock(writeMutex);
+		if (!outbound.failed)
+		{
+			if (!OutboundPending())
+				return true;
+
+			outbound.calls.fetch_add(1, std::memory_order_relaxed);
+			size_t sent = transport->Write(outbound.buffer.get() + outbound.start, outbound.end - outbound.start);
+			if (transport->IsOpen())
+			{
+				outbound.start += sent;
+				outbound.queuedBytes = outbound.end - outbound.start;
+				if (OutboundPending())
+					return false;
+
+				EndStall();
+				return true;
+			}
+		}
+	}
+	Close();
+	return false;
+}
+
+void RpcConnection::EndStall()
+{
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - outbound.stallStart);
+	outbound.stallTime.fetch_add((uint64_t)elapsed.count(), std::memory_order_relaxed);
+
+	// stalls are rare, don't hold on to the memory
+	outbound.buffer.reset();
+	outbound.capacity = 0;
+	outbound.start = 0;
+	outbound.end = 0;
+	outbound.queuedBytes = 0;
+}
+
 bool RpcConnection::Read(JsonDocument& message)
+{
+	char* payload;
+	size_t length;
+	if (!Read(payload, length))
+		return false;
+
+	message.ParseFrame(payload);
+	return true;
+}
+
+bool RpcConnection::Read(char*& message, size_t& length)
 {
 	if (state == State::Disconnected)
 		return false;
 
+	// the previous payload is no longer in use
+	if (inbound.terminatorAt)
+	{
+		*inbound.terminatorAt = inbound.terminatorSaved;
+		inbound.terminatorAt = nullptr;
+	}
+
 	for (;;)
 	{
-		if (!connection.Read(&frame, sizeof(MessageFrameHeader)))
+		if (inbound.discardLength)
 		{
-			if (!connection.isOpen)
-			{
-				lastErrorCode = (int)ErrorCode::PipeClosed;
-				lastErrorMessage = "Pipe closed";
-				Close();
-			}
-			return false;
+			if (inbound.start == inbound.end && !ReadAhead(0))
+				return ReadIncomplete();
+
+			size_t skipped = std::min(inbound.end - inbound.start, inbound.discardLength);
+			inbound.start += skipped;
+			inbound.discardLength -= skipped;
+			continue;
 		}
 
-		if (frame.length > 0)
+		MessageFrameHeader header{};
+		size_t available = inbound.end - inbound.start;
+		size_t frameSize = sizeof(header);
+		if (available >= sizeof(header))
 		{
-			if (!connection.Read(frame.message, frame.length))
+			memcpy(&header, inbound.buffer.get() + inbound.start, sizeof(header));
+			if ((uint32_t)header.opcode > (uint32_t)Opcode::Pong)
 			{
 				lastErrorCode = (int)ErrorCode::ReadCorrupt;
-				lastErrorMessage = "Partial data in frame";
+				lastErrorMessage = "Bad ipc frame";
 				Close();
 				return false;
 			}
-			frame.message[frame.length] = 0;
+
+			frameSize += header.length;
+			if (frameSize > maxFrameSize)
+			{
+				// too big to keep, skip it and stay connected
+				inbound.dropped.fetch_add(1, std::memory_order_relaxed);
+				size_t buffered = std::min(available, frameSize);
+				inbound.start += buffered;
+				inbound.discardLength = frameSize - buffered;
+				continue;
+			}
 		}
 
-		switch (frame.opcode)
+		// frames may arrive in pieces, keep what we have until the rest shows up
+		if (available < frameSize)
+		{
+			if (!ReadAhead(frameSize))
+				return ReadIncomplete();
+			continue;
+		}
+
+		char* payload = inbound.buffer.get() + inbound.start + sizeof(header);
+		inbound.start += frameSize;
+		inbound.smallFrames = frameSize < InboundBufferSize ? inbound.smallFrames + 1 : 0;
+
+		switch (header.opcode)
 		{
 			case Opcode::Close:
 			{
-				message.ParseInsitu(frame.message);
-				lastErrorCode = GetIntMember(&message, "code");
-				lastErrorMessage = GetStrMember(&message, "message", "");
+				payload[header.length] = 0;
+				document.ParseFrame(payload);
+				lastErrorCode = GetIntMember(&document, "code");
+				lastErrorMessage = GetStrMember(&document, "message", "");
 				Close();
 				return false;
 			}
 
 			case Opcode::Frame:
-				message.ParseInsitu(frame.message);
+				// the terminator may overwrite the start of the next frame, so remember that byte
+				inbound.terminatorAt = payload + header.length;
+				inbound.terminatorSaved = *inbound.terminatorAt;
+				*inbound.terminatorAt = 0;
+				inbound.frames.fetch_add(1, std::memory_order_relaxed);
+
+				message = payload;
+				length = header.length;
 				return true;
 
 			case Opcode::Ping:
-				frame.opcode = Opcode::Pong;
-				if (!connection.Write(&frame, sizeof(MessageFrameHeader) + frame.length))
-					Close();
+			{
+				// echo the payload from the inbound buffer without touching it
+				MessageFrameHeader pong{Opcode::Pong, header.length};
+				ConnectionBuffer buffers[]{{&pong, sizeof(pong)}, {payload, header.length}};
+				if (!Send(buffers, 2))
+					return false;
 				break;
+			}
 
 			case Opcode::Pong:
 				break;
@@ -139,3 +375,80 @@ bool RpcConnection::Read(JsonDocument& message)
 		}
 	}
 }
+
+bool RpcConnection::ReadAhead(size_t frameSize)
+{
+	if (inbound.start == inbound.end)
+	{
+		inbound.start = 0;
+		inbound.end = 0;
+
+		// the large frames are over, give the memory back
+		if (inbound.capacity > InboundBufferSize && inbound.smallFrames >= InboundShrinkFrames)
+			ResizeInbound(InboundBufferSize);
+	}
+
+	if (!inbound.buffer)
+		ResizeInbound(InboundBufferSize);
+
+	if (frameSize > inbound.capacity)
+		ResizeInbound(std::max(frameSize, std::min<size_t>(inbound.capacity * 2, maxFrameSize)));
+	else if (inbound.end == inbound.capacity && inbound.capacity < maxFrameSize)
+	{
+		// reads are filling the buffer, let the next ones take more at once
+		inbound.smallFrames = 0;
+		ResizeInbound(std::min<size_t>(inbound.capacity * 2, maxFrameSize));
+	}
+	else if (inbound.start + frameSize > inbound.capacity)
+	{
+		// make room for the whole frame
+		memmove(inbound.buffer.get(), inbound.buffer.get() + inbound.start, inbound.end - inbound.start);
+		inbound.end -= inbound.start;
+		inbound.start = 0;
+	}
+
+	// take everything the transport has, which may be many frames
+	inbound.calls.fetch_add(1, std::memory_order_relaxed);
+	size_t received = transport->Read(inbound.buffer.get() + inbound.end, inbound.capacity - inbound.end);
+	inbound.end += received;
+	return received > 0;
+}
+
+void RpcConnection::ResizeInbound(size_t capacity)
+{
+	// never below what is buffered
+	capacity = std::max(capacity, inbound.end - inbound.start);
+
+	auto buffer = std::unique_ptr<char[]>(new char[capacity + 1]);
+	if (inbound.buffer)
+		memcpy(buffer.get(), inbound.buffer.get() + inbound.start, inbound.end - inbound.start);
+
+	inbound.end -= inbound.start;
+	inbound.start = 0;
+	inbound.buffer = std::move(buffer);
+	inbound.capacity = capacity;
+}
+
+void RpcConnection::ResetInbound()
+{
+	// a disconnected instance holds no inbound memory
+	document.Release();
+	inbound.buffer.reset();
+	inbound.capacity = 0;
+	inbound.start = 0;
+	inbound.end = 0;
+	inbound.terminatorAt = nullptr;
+	inbound.discardLength = 0;
+	inbound.smallFrames = 0;
+}
+
+bool RpcConnection::ReadIncomplete()
+{
+	if (!transport->IsOpen())
+	{
+		lastErrorCode = (int)ErrorCode::PipeClosed;
+		lastErrorMessage = "Pipe closed";
+		Close();
+	}
+	return false;
+}
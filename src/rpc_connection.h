@@ -1,12 +1,26 @@
 #pragma once
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include "connection.h"
 #include "fixed_string.h"
+#include "serialization.h"
 
 // libuv's buffer size for named pipes; discord will never use this
 constexpr size_t MaxRpcFrameSize = 64 * 1024;
-class JsonDocument;
+// longest payload written in one frame, after the 8 byte header
+constexpr size_t MaxRpcPayloadSize = MaxRpcFrameSize - 8;
+// inbound buffer size while frames are small, it grows up to the frame size cap when needed
+constexpr size_t InboundBufferSize = 4 * 1024;
+// smallest frame size cap accepted, anything lower could skip READY and never connect
+constexpr size_t MinRpcFrameSize = InboundBufferSize;
+// frames in a row that fit InboundBufferSize before a grown buffer is given back
+constexpr size_t InboundShrinkFrames = 32;
+// unsent bytes kept while the peer isn't reading, past this it is treated as gone
+constexpr size_t MaxOutboundQueue = 1024 * 1024;
 
 class RpcConnection
 {
@@ -20,6 +34,7 @@ private:
 		Success = 0,
 		PipeClosed = 1,
 		ReadCorrupt = 2,
+		WriteStalled = 3,
 	};
 
 	enum class Opcode : uint32_t
@@ -36,11 +51,7 @@ private:
 		Opcode opcode;
 		uint32_t length;
 	};
-
-	struct MessageFrame : public MessageFrameHeader
-	{
-		char message[MaxRpcFrameSize - sizeof(MessageFrameHeader)];
-	};
+	static_assert(sizeof(MessageFrameHeader) == MaxRpcFrameSize - MaxRpcPayloadSize);
 
 	enum class State : uint32_t
 	{
@@ -50,23 +61,119 @@ private:
 	};
 
 	BaseConnection connection;
-	State state{State::Disconnected};
+	Transport* transport{&connection};
+	std::atomic<State> state{State::Disconnected};
 	FixedString<64> appId;
 	int lastErrorCode{(int)ErrorCode::Success};
 	FixedString<256> lastErrorMessage;
-	MessageFrame frame;
+	// parse memory reused by every message that needs a tree
+	JsonDocument document;
+
+	// read side, only touched by Read and what it calls
+	struct alignas(64) InboundState
+	{
+		// filled as far as the transport allows and split into frames in place
+		// allocated with one spare byte so a payload ending the buffer can still be terminated
+		std::unique_ptr<char[]> buffer;
+		size_t capacity{0};
+		size_t start{0};
+		size_t end{0};
+		// bytes of a frame over the cap that are still to be skipped
+		size_t discardLength{0};
+		size_t smallFrames{0};
+		// byte that the last payload's terminator replaced, put back on the next Read
+		char* terminatorAt{nullptr};
+		char terminatorSaved{0};
+
+		std::atomic_uint64_t frames{0};
+		std::atomic_uint64_t calls{0};
+		std::atomic_uint64_t dropped{0};
+	};
+
+	// write side, kept apart so writing never touches what the reader holds
+	// guarded by writeMutex, a direct write may come from a caller thread
+	struct alignas(64) OutboundState
+	{
+		// bytes the transport couldn't take yet, they go out before anything written later
+		std::unique_ptr<char[]> buffer;
+		size_t capacity{0};
+		size_t start{0};
+		size_t end{0};
+		std::chrono::steady_clock::time_point stallStart;
+		// a direct write broke the connection, the io thread closes it
+		bool failed{false};
+
+		std::atomic_uint64_t frames{0};
+		std::atomic_uint64_t calls{0};
+		std::atomic_size_t queuedBytes{0};
+		std::atomic_uint64_t stalls{0};
+		std::atomic_uint64_t stallTime{0};
+		// payloads longer than MaxRpcPayloadSize, left out of a write
+		std::atomic_uint64_t oversized{0};
+		// bumped by Close, bytes queued before it never reach the peer
+		std::atomic_uint64_t closes{0};
+	};
+
+	std::atomic_size_t maxFrameSize{MaxRpcFrameSize};
+	InboundState inbound;
+	OutboundState outbound;
+	std::mutex writeMutex;
 
 	OnConnect onConnect{ nullptr };
 	OnDisconnect onDisconnect{ nullptr };
 
+	bool Send(const ConnectionBuffer* buffers, size_t count);
+	bool SendLocked(const ConnectionBuffer* buffers, size_t count);
+	bool Enqueue(const void* data, size_t length);
+	inline bool OutboundPending() const { return outbound.start != outbound.end; }
+	void EndStall();
+	bool ReadAhead(size_t frameSize);
+	void ResizeInbound(size_t capacity);
+	void ResetInbound();
+	bool ReadIncomplete();
+
 public:
 	void SetEvents(OnConnect onConnect, OnDisconnect onDisconnect);
 	void SetApplicationId(const std::string_view& id);
+	// replaces the ipc socket/pipe, nullptr restores it; only while disconnected
+	void SetTransport(Transport* newTransport);
+	// largest inbound frame, header included; bigger ones are skipped without disconnecting
+	// raised to MinRpcFrameSize if lower
+	inline void SetMaxFrameSize(size_t size) { maxFrameSize = size < MinRpcFrameSize ? MinRpcFrameSize : size; }
 
 	inline bool IsOpen() const { return state == State::Connected; }
+	inline bool IsConnecting() const { return state == State::Connecting; }
+	inline int GetHandle() const { return transport->GetHandle(); }
+	inline uint64_t GetFramesWritten() const { return outbound.frames.load(std::memory_order_relaxed); }
+	inline uint64_t GetWriteCalls() const { return outbound.calls.load(std::memory_order_relaxed); }
+	inline uint64_t GetFramesRead() const { return inbound.frames.load(std::memory_order_relaxed); }
+	inline uint64_t GetReadCalls() const { return inbound.calls.load(std::memory_order_relaxed); }
+	inline uint64_t GetFramesDropped() const { return inbound.dropped.load(std::memory_order_relaxed); }
+	// bytes the inbound buffer holds on to, only meaningful on the thread that reads
+	inline size_t GetInboundCapacity() const { return inbound.capacity; }
+	inline size_t GetQueuedBytes() const { return outbound.queuedBytes.load(std::memory_order_relaxed); }
+	inline uint64_t GetWriteStalls() const { return outbound.stalls.load(std::memory_order_relaxed); }
+	// microseconds spent with bytes waiting for the peer, finished stalls only
+	inline uint64_t GetStallTime() const { return outbound.stallTime.load(std::memory_order_relaxed); }
+	inline bool HasQueuedWrites() const { return outbound.queuedBytes.load(std::memory_order_relaxed) != 0; }
+	inline uint64_t GetCloseCount() const { return outbound.closes.load(std::memory_order_relaxed); }
+	inline uint64_t GetFramesOversized() const { return outbound.oversized.load(std::memory_order_relaxed); }
 
 	void Open();
 	void Close();
+	// writes what was queued earlier, true once nothing is left
+	bool Flush();
+	// false only if the connection closed, bytes the transport can't take yet are queued
+	// a payload too long for a frame is skipped and counted, the others still go out
 	bool Write(const void* data, size_t length);
+	bool Write(const ConnectionBuffer* payloads, size_t count);
+	// one frame from a caller thread, only if connected and nothing is queued or being written;
+	// never waits for the io thread and never closes, false means the io thread has to send it
+	// sockets take what fits without blocking; a Windows pipe write blocks until the client reads it,
+	// so CmdChannel never writes directly there
+	// queued tells whether part of the frame is left for the io thread to flush
+	bool WriteDirect(const void* data, size_t length, bool& queued);
+	// next frame's payload, nul terminated and writable in place; valid until the next Read
+	bool Read(char*& message, size_t& length);
 	bool Read(JsonDocument& message);
 };
@@ -1,8 +1,16 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <string_view>
+
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
 
 #include "serialization.h"
+#include "json_escape.h"
 #include "discord_rpc.hpp"
+#include "presence.h"
 
 class DirectStringBuffer
 {
@@ -29,6 +37,136 @@ public:
 	size_t GetSize() const { return (size_t)(current - buffer); }
 };
 
+ParseArena::ParseArena(size_t capacity) : initialCapacity(capacity)
+{
+}
+
+void* ParseArena::Malloc(size_t size)
+{
+	if (size == 0)
+		return nullptr;
+
+	if (blocks.empty())
+		blocks.push_back({std::unique_ptr<char[]>(new char[initialCapacity]), initialCapacity});
+
+	// rapidjson expects 8 byte alignment
+	size = (size + 7) & ~(size_t)7;
+
+	if (used + size > blocks[current].capacity)
+	{
+		// only grows past the high-water mark, Reset merges the blocks afterwards
+		++current;
+		used = 0;
+		if (current == blocks.size() || blocks[current].capacity < size)
+		{
+			size_t capacity = std::max(size, blocks[current - 1].capacity);
+			blocks.insert(blocks.begin() + current, {std::unique_ptr<char[]>(new char[capacity]), capacity});
+		}
+	}
+
+	last = blocks[current].data.get() + used;
+	used += size;
+	return last;
+}
+
+void* ParseArena::Realloc(void* originalPtr, size_t originalSize, size_t newSize)
+{
+	if (originalPtr == nullptr)
+		return Malloc(newSize);
+	if (newSize == 0)
+		return nullptr;
+	if (newSize <= originalSize)
+		return originalPtr;
+
+	// the latest allocation can simply be extended
+	size_t grow = ((newSize + 7) & ~(size_t)7) - ((originalSize + 7) & ~(size_t)7);
+	if (originalPtr == last && used + grow <= blocks[current].capacity)
+	{
+		used += grow;
+		return originalPtr;
+	}
+
+	void* result = Malloc(newSize);
+	memcpy(result, originalPtr, originalSize);
+	return result;
+}
+
+bool ParseArena::Reset()
+{
+	// what the last frame took, counting the blocks it filled before the current one
+	size_t frameUsed = used;
+	for (size_t i = 0; i < current; ++i)
+		frameUsed += blocks[i].capacity;
+
+	bool trimmed = false;
+	if (blocks.size() > 1)
+	{
+		size_t capacity = Capacity();
+		blocks.clear();
+		blocks.push_back({std::unique_ptr<char[]>(new char[capacity]), capacity});
+		smallFrames = 0;
+	}
+	else if (!blocks.empty() && blocks[0].capacity > initialCapacity)
+	{
+		smallFrames = frameUsed <= initialCapacity ? smallFrames + 1 : 0;
+		if (smallFrames >= ShrinkFrames)
+		{
+			blocks[0] = {std::unique_ptr<char[]>(new char[initialCapacity]), initialCapacity};
+			smallFrames = 0;
+			trimmed = true;
+		}
+	}
+
+	current = 0;
+	used = 0;
+	last = nullptr;
+	return trimmed;
+}
+
+void ParseArena::Release()
+{
+	blocks.clear();
+	current = 0;
+	used = 0;
+	smallFrames = 0;
+	last = nullptr;
+}
+
+size_t ParseArena::Capacity() const
+{
+	size_t capacity = 0;
+	for (auto& block : blocks)
+		capacity += block.capacity;
+	return capacity;
+}
+
+void* ParseStackAllocator::Realloc(void* originalPtr, size_t originalSize, size_t newSize)
+{
+	(void)originalSize;
+	if (newSize == 0)
+		return nullptr;
+	if (newSize <= capacity)
+		return block;
+
+	// a stack that starts over has nothing worth copying
+	if (!originalPtr)
+		Release();
+	char* grown = (char*)std::realloc(block, newSize);
+	if (!grown)
+		return nullptr;
+
+	block = grown;
+	capacity = newSize;
+	return block;
+}
+
+void ParseStackAllocator::Release()
+{
+	std::free(block);
+	block = nullptr;
+	capacity = 0;
+}
+
 // writer appears to need about 16 bytes per nested object level (with 64bit size_t)
 constexpr size_t WriterNestingLevels = 2048 / (2 * sizeof(size_t));
 
@@ -103,129 +241,383 @@ struct WriteObject
 	~WriteObject() { writer.EndObject(); }
 };
 
-struct WriteArray
+static void JsonWriteNonce(JsonWriter& writer, int nonce)
 {
-	JsonWriter& writer;
-	template <typename T>
-	WriteArray(JsonWriter& w, T& name)
-	  : writer(w)
+	WriteKey(writer, "nonce");
+	char nonceBuffer[32];
+	NumberToString(nonceBuffer, nonce);
+	writer.String(nonceBuffer);
+}
+
+// SET_ACTIVITY has a fixed shape, so it skips the generic writer: constant fragments are
+// copied whole and only the values are escaped or formatted
+class FragmentWriter
+{
+	char* buffer;
+	char* end;
+	char* current;
+
+public:
+	FragmentWriter(char* dest, size_t maxLen)
+		: buffer(dest)
+		, end(dest + maxLen)
+		, current(dest)
 	{
-		WriteKey(writer, name);
-		writer.StartArray();
 	}
-	~WriteArray() { writer.EndArray(); }
+
+	void Raw(const char* text, size_t length)
+	{
+		length = std::min(length, (size_t)(end - current));
+		memcpy(current, text, length);
+		current += length;
+	}
+
+	void Raw(const std::string_view& text)
+	{
+		Raw(text.data(), text.size());
+	}
+
+	void Put(char c)
+	{
+		if (current < end)
+			*current++ = c;
+	}
+
+	void String(const std::string_view& value);
+
+	void Int(int64_t value)
+	{
+		char digits[24];
+		auto result = std::to_chars(digits, digits + sizeof(digits), value);
+		Raw(digits, (size_t)(result.ptr - digits));
+	}
+
+	size_t Size() const { return (size_t)(current - buffer); }
 };
 
-template <typename T>
-void WriteOptionalString(JsonWriter& w, T& k, const std::string_view& value)
+// same escaping as rapidjson's Writer: quote, backslash and control characters
+static constexpr auto EscapeTable = []()
 {
-	if (!value.empty())
+	std::array<char, 256> table{};
+	for (int c = 0; c < 0x20; ++c)
+		table[c] = 'u';
+	table['\b'] = 'b';
+	table['\t'] = 't';
+	table['\n'] = 'n';
+	table['\f'] = 'f';
+	table['\r'] = 'r';
+	table['"'] = '"';
+	table['\\'] = '\\';
+	return table;
+}();
+
+void FragmentWriter::String(const std::string_view& value)
+{
+	static constexpr char Hex[] = "0123456789ABCDEF";
+
+	const char* text = value.data();
+	const char* stop = text + value.size();
+
+	Put('"');
+	while (text < stop)
 	{
-		w.Key(k, sizeof(T) - 1);
-		w.String(value.data(), (uint32_t)value.size());
+		// copy clean runs in one go
+		const char* run = text;
+		text = FindJsonEscape(text, stop);
+		Raw(run, (size_t)(text - run));
+
+		if (text == stop)
+			break;
+
+		unsigned char c = (unsigned char)*text++;
+		char code = EscapeTable[c];
+		if (code == 'u')
+		{
+			char escaped[]{'\\', 'u', '0', '0', Hex[c >> 4], Hex[c & 0xF]};
+			Raw(escaped, sizeof(escaped));
+		}
+		else
+		{
+			char escaped[]{'\\', code};
+			Raw(escaped, sizeof(escaped));
+		}
 	}
+	Put('"');
 }
 
-static void JsonWriteNonce(JsonWriter& writer, int nonce)
+struct PresenceStringField
 {
-	WriteKey(writer, "nonce");
-	char nonceBuffer[32];
-	NumberToString(nonceBuffer, nonce);
-	writer.String(nonceBuffer);
+	std::string_view key; // rendered with quotes and colon
+	std::string_view CDiscordRichPresence::* value;
+	size_t maxLength;
+};
+
+constexpr PresenceStringField ActivityFields[]{
+	{"\"state\":", &CDiscordRichPresence::state, MaxPresenceString},
+	{"\"details\":", &CDiscordRichPresence::details, MaxPresenceString},
+};
+
+constexpr PresenceStringField AssetFields[]{
+	{"\"large_image\":", &CDiscordRichPresence::largeImageKey, MaxPresenceImageKey},
+	{"\"large_text\":", &CDiscordRichPresence::largeImageText, MaxPresenceString},
+	{"\"small_image\":", &CDiscordRichPresence::smallImageKey, MaxPresenceImageKey},
+	{"\"small_text\":", &CDiscordRichPresence::smallImageText, MaxPresenceString},
+};
+
+constexpr PresenceStringField SecretFields[]{
+	{"\"match\":", &CDiscordRichPresence::matchSecret, MaxPresenceString},
+	{"\"join\":", &CDiscordRichPresence::joinSecret, MaxPresenceString},
+	{"\"spectate\":", &CDiscordRichPresence::spectateSecret, MaxPresenceString},
+};
+
+template <size_t Count>
+static bool HasAnyField(const CDiscordRichPresence& presence, const PresenceStringField (&fields)[Count])
+{
+	for (auto& field : fields)
+	{
+		if (!(presence.*field.value).empty())
+			return true;
+	}
+	return false;
 }
 
-size_t JsonWriteRichPresenceObj(char* dest, size_t maxLen, int nonce, int pid, const CDiscordRichPresence* presence)
+// writes the non-empty fields, each followed by a comma
+template <size_t Count>
+static void WriteMembers(FragmentWriter& writer, const CDiscordRichPresence& presence, const PresenceStringField (&fields)[Count])
 {
-	JsonWriter writer(dest, maxLen);
+	for (auto& field : fields)
+	{
+		auto& value = presence.*field.value;
+		if (!value.empty())
+		{
+			writer.Raw(field.key);
+			writer.String(Utf8Prefix(value, field.maxLength));
+			writer.Put(',');
+		}
+	}
+}
 
+// writes a nested object of the non-empty fields, followed by a comma
+template <size_t Count>
+static void WriteObjectMembers(FragmentWriter& writer, const std::string_view& key, const CDiscordRichPresence& presence, const PresenceStringField (&fields)[Count])
+{
+	if (!HasAnyField(presence, fields))
+		return;
+
+	writer.Raw(key);
+	const char* separator = "{";
+	for (auto& field : fields)
 	{
-		WriteObject top(writer);
+		auto& value = presence.*field.value;
+		if (!value.empty())
+		{
+			writer.Put(*separator);
+			writer.Raw(field.key);
+			writer.String(Utf8Prefix(value, field.maxLength));
+			separator = ",";
+		}
+	}
+	writer.Raw("},", 2);
+}
 
-		JsonWriteNonce(writer, nonce);
+static void WriteActivity(FragmentWriter& writer, const CDiscordRichPresence& presence)
+{
+	using namespace std::literals;
 
-		WriteKey(writer, "cmd");
-		writer.String("SET_ACTIVITY");
+	writer.Raw(",\"activity\":{"sv);
+	WriteMembers(writer, presence, ActivityFields);
+
+	if (presence.startTimestamp || presence.endTimestamp)
+	{
+		writer.Raw("\"timestamps\":{"sv);
+		if (presence.startTimestamp)
+		{
+			writer.Raw("\"start\":"sv);
+			writer.Int(presence.startTimestamp);
+		}
+		if (presence.endTimestamp)
+		{
+			if (presence.startTimestamp)
+				writer.Put(',');
+			writer.Raw("\"end\":"sv);
+			writer.Int(presence.endTimestamp);
+		}
+		writer.Raw("},"sv);
+	}
 
+	WriteObjectMembers(writer, "\"assets\":"sv, presence, AssetFields);
+
+	if (!presence.partyId.empty() || presence.partySize ||
+		presence.partyMax || presence.partyPrivacy)
+	{
+		const char* separator = "{";
+		writer.Raw("\"party\":"sv);
+		if (!presence.partyId.empty())
 		{
-			WriteObject args(writer, "args");
-
-			WriteKey(writer, "pid");
-			writer.Int(pid);
-
-			if (presence != nullptr)
-			{
-				WriteObject activity(writer, "activity");
-
-				WriteOptionalString(writer, "state", presence->state);
-				WriteOptionalString(writer, "details", presence->details);
-
-				if (presence->startTimestamp || presence->endTimestamp)
-				{
-					WriteObject timestamps(writer, "timestamps");
-
-					if (presence->startTimestamp)
-					{
-						WriteKey(writer, "start");
-						writer.Int64(presence->startTimestamp);
-					}
-
-					if (presence->endTimestamp)
-					{
-						WriteKey(writer, "end");
-						writer.Int64(presence->endTimestamp);
-					}
-				}
-
-				if (!presence->largeImageKey.empty() ||
-					!presence->largeImageText.empty() ||
-					!presence->smallImageKey.empty() ||
-					!presence->smallImageText.empty())
-				{
-					WriteObject assets(writer, "assets");
-					WriteOptionalString(writer, "large_image", presence->largeImageKey);
-					WriteOptionalString(writer, "large_text", presence->largeImageText);
-					WriteOptionalString(writer, "small_image", presence->smallImageKey);
-					WriteOptionalString(writer, "small_text", presence->smallImageText);
-				}
-
-				if (!presence->partyId.empty() || presence->partySize ||
-					presence->partyMax || presence->partyPrivacy)
-				{
-					WriteObject party(writer, "party");
-					WriteOptionalString(writer, "id", presence->partyId);
-					if (presence->partySize && presence->partyMax)
-					{
-						WriteArray size(writer, "size");
-						writer.Int(presence->partySize);
-						writer.Int(presence->partyMax);
-					}
-
-					if (presence->partyPrivacy)
-					{
-						WriteKey(writer, "privacy");
-						writer.Int(presence->partyPrivacy);
-					}
-				}
-
-				if (!presence->matchSecret.empty() ||
-					!presence->joinSecret.empty() ||
-					!presence->spectateSecret.empty())
-				{
-					WriteObject secrets(writer, "secrets");
-					WriteOptionalString(writer, "match", presence->matchSecret);
-					WriteOptionalString(writer, "join", presence->joinSecret);
-					WriteOptionalString(writer, "spectate", presence->spectateSecret);
-				}
-
-				writer.Key("instance");
-				writer.Bool(presence->instance != 0);
-			}
+			writer.Put(*separator);
+			writer.Raw("\"id\":"sv);
+			writer.String(Utf8Prefix(presence.partyId, MaxPresenceString));
+			separator = ",";
 		}
+		if (presence.partySize && presence.partyMax)
+		{
+			writer.Put(*separator);
+			writer.Raw("\"size\":["sv);
+			writer.Int(presence.partySize);
+			writer.Put(',');
+			writer.Int(presence.partyMax);
+			writer.Put(']');
+			separator = ",";
+		}
+		if (presence.partyPrivacy)
+		{
+			writer.Put(*separator);
+			writer.Raw("\"privacy\":"sv);
+			writer.Int(presence.partyPrivacy);
+			separator = ",";
+		}
+		// party may hold nothing but an unpaired size or max
+		if (*separator == '{')
+			writer.Put('{');
+		writer.Raw("},"sv);
 	}
 
+	WriteObjectMembers(writer, "\"secrets\":"sv, presence, SecretFields);
+
+	if (presence.instance)
+		writer.Raw("\"instance\":true}"sv);
+	else
+		writer.Raw("\"instance\":false}"sv);
+}
+
+size_t JsonWriteRichPresenceObj(char* dest, size_t maxLen, int nonce, int pid, const CDiscordRichPresence* presence)
+{
+	using namespace std::literals;
+	FragmentWriter writer(dest, maxLen);
+
+	// nonce trails the payload like in JsonWriteJoinReply, so the leading fragment never changes
+	writer.Raw("{\"cmd\":\"SET_ACTIVITY\",\"args\":{\"pid\":"sv);
+	writer.Int(pid);
+
+	if (presence != nullptr)
+		WriteActivity(writer, *presence);
+
+	writer.Raw("},\"nonce\":\""sv);
+	writer.Int(nonce);
+	writer.Raw("\"}"sv);
+
 	return writer.Size();
 }
 
+void PresenceTemplate::Set(int pid, const CDiscordRichPresence& presence)
+{
+	using namespace std::literals;
+
+	// fixed members come first, so each update only rewrites the tail of the activity
+	head.resize(MaxPresenceCommand);
+	FragmentWriter writer(head.data(), head.size());
+	writer.Raw("{\"cmd\":\"SET_ACTIVITY\",\"args\":{\"pid\":"sv);
+	writer.Int(pid);
+	writer.Raw(",\"activity\":{"sv);
+	WriteObjectMembers(writer, "\"assets\":"sv, presence, AssetFields);
+	WriteObjectMembers(writer, "\"secrets\":"sv, presence, SecretFields);
+	head.resize(writer.Size());
+
+	partyId.clear();
+	if (!presence.partyId.empty())
+	{
+		partyId.resize(presence.partyId.size() * 6 + 8);
+		FragmentWriter idWriter(partyId.data(), partyId.size());
+		idWriter.Raw("\"id\":"sv);
+		idWriter.String(Utf8Prefix(presence.partyId, MaxPresenceString));
+		partyId.resize(idWriter.Size());
+	}
+
+	partyMax = presence.partyMax;
+	partyPrivacy = presence.partyPrivacy;
+	hasParty = !partyId.empty() || partyMax || partyPrivacy;
+	instance = presence.instance != 0;
+	fingerprint = JsonFingerprint(head.data(), head.size());
+}
+
+size_t PresenceTemplate::Render(char* dest, size_t maxLen, bool writeHead, const CDiscordPresenceFields& fields, int nonce) const
+{
+	using namespace std::literals;
+
+	size_t headLength = std::min(head.size(), maxLen);
+	if (writeHead)
+		memcpy(dest, head.data(), headLength);
+
+	FragmentWriter writer(dest + headLength, maxLen - headLength);
+
+	if (!fields.state.empty())
+	{
+		writer.Raw("\"state\":"sv);
+		writer.String(Utf8Prefix(fields.state, MaxPresenceString));
+		writer.Put(',');
+	}
+
+	if (!fields.details.empty())
+	{
+		writer.Raw("\"details\":"sv);
+		writer.String(Utf8Prefix(fields.details, MaxPresenceString));
+		writer.Put(',');
+	}
+
+	if (fields.startTimestamp || fields.endTimestamp)
+	{
+		writer.Raw("\"timestamps\":{"sv);
+		if (fields.startTimestamp)
+		{
+			writer.Raw("\"start\":"sv);
+			writer.Int(fields.startTimestamp);
+		}
+		if (fields.endTimestamp)
+		{
+			if (fields.startTimestamp)
+				writer.Put(',');
+			writer.Raw("\"end\":"sv);
+			writer.Int(fields.endTimestamp);
+		}
+		writer.Raw("},"sv);
+	}
+
+	if (hasParty || fields.partySize)
+	{
+		bool first = partyId.empty();
+		writer.Raw("\"party\":{"sv);
+		writer.Raw(partyId);
+		if (fields.partySize && partyMax)
+		{
+			if (!first)
+				writer.Put(',');
+			writer.Raw("\"size\":["sv);
+			writer.Int(fields.partySize);
+			writer.Put(',');
+			writer.Int(partyMax);
+			writer.Put(']');
+			first = false;
+		}
+		if (partyPrivacy)
+		{
+			if (!first)
+				writer.Put(',');
+			writer.Raw("\"privacy\":"sv);
+			writer.Int(partyPrivacy);
+		}
+		writer.Raw("},"sv);
+	}
+
+	if (instance)
+		writer.Raw("\"instance\":true}},\"nonce\":\""sv);
+	else
+		writer.Raw("\"instance\":false}},\"nonce\":\""sv);
+	writer.Int(nonce);
+	writer.Raw("\"}"sv);
+
+	return headLength + writer.Size();
+}
+
 size_t JsonWriteHandshakeObj(char* dest, size_t maxLen, int version, const char* applicationId)
 {
 	JsonWriter writer(dest, maxLen);
@@ -281,29 +673,60 @@ size_t JsonWriteUnsubscribeCommand(char* dest, size_t maxLen, int nonce, const c
 
 size_t JsonWriteJoinReply(char* dest, size_t maxLen, const std::string_view& userId, int reply, int nonce)
 {
-	JsonWriter writer(dest, maxLen);
+	using namespace std::literals;
+	FragmentWriter writer(dest, maxLen);
 
-	{
-		WriteObject obj(writer);
+	if (reply == DISCORD_REPLY_YES)
+		writer.Raw("{\"cmd\":\"SEND_ACTIVITY_JOIN_INVITE\",\"args\":{\"user_id\":"sv);
+	else
+		writer.Raw("{\"cmd\":\"CLOSE_ACTIVITY_JOIN_REQUEST\",\"args\":{\"user_id\":"sv);
 
-		WriteKey(writer, "cmd");
-		if (reply == DISCORD_REPLY_YES)
-			writer.String("SEND_ACTIVITY_JOIN_INVITE");
-		else
-			writer.String("CLOSE_ACTIVITY_JOIN_REQUEST");
+	writer.String(userId);
+	writer.Raw("},\"nonce\":\""sv);
+	writer.Int(nonce);
+	writer.Raw("\"}"sv);
 
-		WriteKey(writer, "args");
-		{
-			WriteObject args(writer);
+	return writer.Size();
+}
 
-			WriteKey(writer, "user_id");
-			writer.String(userId.data(), (uint32_t)userId.size());
+uint64_t JsonCommandFingerprint(const char* json, size_t length)
+{
+	// nonce is the last member and holds only digits, so the last comma precedes it
+	for (size_t i = length; i > 0; --i)
+	{
+		if (json[i - 1] == ',')
+		{
+			length = i - 1;
+			break;
 		}
+	}
 
-		JsonWriteNonce(writer, nonce);
+	return JsonFingerprint(json, length);
+}
+
+uint64_t JsonFingerprint(const char* json, size_t length)
+{
+	constexpr uint64_t Multiplier = 0x517cc1b727220a95ull;
+	uint64_t hash = 0xcbf29ce484222325ull ^ length;
+
+	for (; length >= sizeof(uint64_t); json += sizeof(uint64_t), length -= sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, json, sizeof(word));
+		hash = (std::rotl(hash, 5) ^ word) * Multiplier;
 	}
 
-	return writer.Size();
+	if (length)
+	{
+		uint64_t word = 0;
+		memcpy(&word, json, length);
+		hash = (std::rotl(hash, 5) ^ word) * Multiplier;
+	}
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	return hash;
 }
 
 JsonValue* GetObjMember(JsonValue* obj, const char* name)
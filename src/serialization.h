@@ -1,6 +1,10 @@
 #pragma once
 #include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
 #include <string_view>
+#include <vector>
 #include "rapidjson/document.h"
 
 // StackAllocator used to reduce heap allocations
@@ -9,7 +13,7 @@ class FixedLinearAllocator
 {
 public:
 	static const bool kNeedFree = false;
-	char buffer[Size]{};
+	char buffer[Size];
 	char* pointer;
 	char* end;
 
@@ -48,42 +52,157 @@ public:
 	}
 };
 
+// bump allocator kept for the life of a connection; Reset rewinds it between frames
+// and folds any overflow into one block sized to the high-water mark, which is given
+// back once ShrinkFrames frames in a row fit the initial capacity again
+class ParseArena
+{
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t capacity;
+	};
+
+	std::vector<Block> blocks;
+	size_t initialCapacity;
+	size_t current{0};
+	size_t used{0};
+	size_t smallFrames{0};
+	// last allocation, which Realloc may grow in place
+	char* last{nullptr};
+
+public:
+	static const bool kNeedFree = false;
+	static constexpr size_t ShrinkFrames = 32;
+	static constexpr size_t DefaultCapacity = 32 * 1024;
+
+	// nothing is allocated until the first Malloc; rapidjson default-constructs one
+	// for a document that is given no allocator
+	explicit ParseArena(size_t capacity = DefaultCapacity);
+
+	void* Malloc(size_t size);
+	void* Realloc(void* originalPtr, size_t originalSize, size_t newSize);
+	static void Free(void* ptr)
+	{
+		(void)ptr;
+	}
+
+	// true if memory grown for a larger frame was given back
+	bool Reset();
+	// frees every block, the next Malloc starts over at the initial capacity
+	void Release();
+	size_t Capacity() const;
+};
+
+// one heap block for rapidjson's parse stack, kept across parses. rapidjson frees the stack through
+// the static Free once each parse is done and asks for it again on the next one, so Free and a
+// shrink to nothing keep the block; it only goes with Release or the allocator
+class ParseStackAllocator
+{
+	char* block{nullptr};
+	size_t capacity{0};
+
+public:
+	static const bool kNeedFree = false;
+
+	ParseStackAllocator() = default;
+	ParseStackAllocator(const ParseStackAllocator&) = delete;
+	ParseStackAllocator& operator=(const ParseStackAllocator&) = delete;
+	~ParseStackAllocator() { Release(); }
+
+	void* Malloc(size_t size) { return Realloc(nullptr, 0, size); }
+	// serves a single stack, originalPtr is either null or the block
+	void* Realloc(void* originalPtr, size_t originalSize, size_t newSize);
+	static void Free(void* ptr)
+	{
+		(void)ptr;
+	}
+
+	// must not run while a parse is using the stack
+	void Release();
+	size_t Capacity() const { return capacity; }
+};
+
 using MallocAllocator = rapidjson::CrtAllocator;
-using PoolAllocator = rapidjson::MemoryPoolAllocator<>;
 using UTF8 = rapidjson::UTF8<>;
 using StackAllocator = FixedLinearAllocator<2048>;
 
-using JsonDocumentBase = rapidjson::GenericDocument<UTF8, PoolAllocator, StackAllocator>;
+using JsonDocumentBase = rapidjson::GenericDocument<UTF8, ParseArena, ParseStackAllocator>;
 class JsonDocument : public JsonDocumentBase
 {
 public:
-	static constexpr int kDefaultChunkCapacity = 32 * 1024;
+	static constexpr size_t kDefaultChunkCapacity = ParseArena::DefaultCapacity;
+	static constexpr size_t kDefaultStackCapacity = 2 * 1024;
 
-	MallocAllocator mallocAllocator;
-	PoolAllocator poolAllocator;
-	StackAllocator stackAllocator;
+	ParseArena valueArena;
+	ParseStackAllocator stackAllocator;
 
-	char parseBuffer[kDefaultChunkCapacity];
-	
 	JsonDocument()
 	  : JsonDocumentBase(rapidjson::kObjectType,
-						 &poolAllocator,
-						 sizeof(stackAllocator.buffer),
+						 &valueArena,
+						 kDefaultStackCapacity,
 						 &stackAllocator)
-	  , poolAllocator(parseBuffer, sizeof(parseBuffer), kDefaultChunkCapacity, &mallocAllocator)
-	  , stackAllocator()
+	  , valueArena(kDefaultChunkCapacity)
 	{
 	}
+
+	// reuses the memory of the previous message, which must no longer be referenced
+	void ParseFrame(char* message)
+	{
+		// a stack grown for an unusually large frame goes back with the values it held
+		if (valueArena.Reset() && stackAllocator.Capacity() > kDefaultStackCapacity)
+			stackAllocator.Release();
+		ParseInsitu(message);
+	}
+
+	// gives back all parse memory, for when no frames are expected for a while
+	void Release()
+	{
+		valueArena.Release();
+		stackAllocator.Release();
+	}
 };
 
+// streaming reader, for frames that only need a few members picked out
+using JsonReader = rapidjson::GenericReader<UTF8, UTF8, MallocAllocator>;
+template <typename Handler>
+using JsonReaderHandler = rapidjson::BaseReaderHandler<UTF8, Handler>;
+
 // object writers
 struct CDiscordRichPresence;
+struct CDiscordPresenceFields;
 size_t JsonWriteHandshakeObj(char* dest, size_t maxLen, int version, const char* applicationId);
 size_t JsonWriteRichPresenceObj(char* dest, size_t maxLen, int nonce, int pid, const CDiscordRichPresence* presence);
 size_t JsonWriteSubscribeCommand(char* dest, size_t maxLen, int nonce, const char* evtName);
 size_t JsonWriteUnsubscribeCommand(char* dest, size_t maxLen, int nonce, const char* evtName);
 size_t JsonWriteJoinReply(char* dest, size_t maxLen, const std::string_view& userId, int reply, int nonce);
 
+// SET_ACTIVITY pre-rendered around the fields that change between updates
+class PresenceTemplate
+{
+	// everything before the changing fields, ends inside the activity object
+	std::string head;
+	std::string partyId;
+	int partyMax{0};
+	int partyPrivacy{0};
+	bool hasParty{false};
+	bool instance{false};
+	uint64_t fingerprint{0};
+
+public:
+	void Set(int pid, const CDiscordRichPresence& presence);
+	inline bool IsSet() const { return !head.empty(); }
+	inline size_t HeadLength() const { return head.size(); }
+	inline uint64_t HeadFingerprint() const { return fingerprint; }
+
+	// dest may already hold the head from an earlier render, then only what follows it is written
+	size_t Render(char* dest, size_t maxLen, bool writeHead, const CDiscordPresenceFields& fields, int nonce) const;
+};
+
+// fingerprint of a serialized command, ignoring its trailing nonce
+uint64_t JsonCommandFingerprint(const char* json, size_t length);
+uint64_t JsonFingerprint(const char* json, size_t length);
+
 // object property getters
 using JsonValue = JsonDocument::ValueType;
 
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+
+// one piece of a gathered write
+struct ConnectionBuffer
+{
+	const void* data;
+	size_t length;
+};
+
+constexpr size_t MaxConnectionBuffers = 32;
+
+// byte stream RpcConnection speaks the ipc protocol over
+class Transport
+{
+public:
+	virtual ~Transport() = default;
+
+	virtual bool Open() = 0;
+	virtual void Close() = 0;
+	virtual bool IsOpen() const = 0;
+	// handle the io thread can wait on for input, -1 if it has to poll
+	virtual int GetHandle() const = 0;
+
+	// returns bytes written, fewer than asked for when the peer isn't keeping up
+	// on error IsOpen turns false but the handle stays until Close, writes may run beside a read
+	virtual size_t Write(const ConnectionBuffer* buffers, size_t count) = 0;
+	// returns bytes available up to length, 0 if none
+	// on error or end of stream IsOpen turns false, the handle stays until Close like for Write
+	virtual size_t Read(void* data, size_t length) = 0;
+
+	inline size_t Write(const void* data, size_t length)
+	{
+		ConnectionBuffer buffer{data, length};
+		return Write(&buffer, 1);
+	}
+};